@@ -1,6 +1,8 @@
 #pragma once
 #include <cstddef>
+#include <cstring>
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 #include <capnp/serialize.h>
@@ -115,11 +117,56 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// builds events in a buffer that's kept from one event to the next, so building an event doesn't
+// allocate unless it outgrows the buffer
+class ReusableMessageBuilder {
+public:
+  ReusableMessageBuilder(size_t words) : words_(words) {}
+
+  cereal::Event::Builder initEvent(bool valid = true) {
+    if (buf_.size() == 0) {
+      // one more word in front for the segment table
+      buf_ = kj::heapArray<capnp::word>(words_ + 1);
+      memset(buf_.begin(), 0, buf_.size() * sizeof(capnp::word));
+    }
+    // the builder zeroes what it used of the buffer when it's destroyed
+    builder_.emplace(buf_.slice(1, buf_.size()));
+
+    cereal::Event::Builder event = builder_->initRoot<cereal::Event>();
+    struct timespec t;
+    clock_gettime(CLOCK_BOOTTIME, &t);
+    event.setLogMonoTime(t.tv_sec * 1000000000ULL + t.tv_nsec);
+    event.setValid(valid);
+    return event;
+  }
+
+  // valid until the next initEvent
+  kj::ArrayPtr<capnp::byte> toBytes() {
+    auto segments = builder_->getSegmentsForOutput();
+    if (segments.size() == 1) {
+      // the segment table of a single segment message: segment count - 1, and its size in words
+      uint32_t *table = (uint32_t *)buf_.begin();
+      table[0] = 0;
+      table[1] = segments[0].size();
+      return buf_.slice(0, segments[0].size() + 1).asBytes();
+    }
+    flat_ = capnp::messageToFlatArray(segments);
+    return flat_.asBytes();
+  }
+
+private:
+  size_t words_;
+  kj::Array<capnp::word> buf_;
+  std::optional<capnp::MallocMessageBuilder> builder_;
+  kj::Array<capnp::word> flat_;  // events that outgrew buf_
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
   int send(const char *name, MessageBuilder &msg);
+  inline bool all_readers_updated(const char *name) { return sockets_.at(name)->all_readers_updated(); }
   ~PubMaster();
 
 private:
@@ -143,3 +190,11 @@ private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
 };
+
+// msgq hands out heap copies, which are word aligned and can be read in place. others go through aligned_buf
+inline kj::ArrayPtr<const capnp::word> message_words(AlignedBuffer &aligned_buf, Message *msg) {
+  if ((uintptr_t)msg->getData() % sizeof(capnp::word) == 0) {
+    return kj::arrayPtr((const capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word));
+  }
+  return aligned_buf.align(msg);
+}
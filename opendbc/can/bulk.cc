@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <thread>
+
+#include "common.h"
+
+static std::vector<SignalSeries> decode_log(int bus, const std::string &dbc_name, const std::vector<SignalParseOptions> &signals,
+                                            const std::vector<MessageParseOptions> &options, LogData log, bool sendcan, bool checks) {
+  CANParser parser(bus, dbc_name, options, signals);
+  parser.set_checks(checks, checks);
+
+  std::vector<SignalSeries> series;
+  for (const auto &sig : signals) {
+    series.push_back({.address = sig.address, .name = sig.name});
+  }
+  // the parser also tracks checksums and counters, which are not part of the output
+  std::vector<int> series_idx;
+  for (const auto &sig : parser.signal_ids()) {
+    auto it = std::find_if(signals.begin(), signals.end(), [&](auto &s) {
+      return s.address == sig.address && strcmp(s.name, sig.name) == 0;
+    });
+    series_idx.push_back(it == signals.end() ? -1 : it - signals.begin());
+  }
+
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data, log.size / sizeof(capnp::word));
+  try {
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      cereal::Event::Reader event = reader.getRoot<cereal::Event>();
+      if (sendcan ? event.isSendcan() : event.isCan()) {
+        const uint64_t sec = event.getLogMonoTime();
+        for (const auto frame : sendcan ? event.getSendcan() : event.getCan()) {
+          if (frame.getSrc() != bus) continue;
+
+          MessageState *state = parser.UpdateFrame(sec, frame.getAddress(), frame.getDat());
+          if (!state) continue;
+
+          for (int i = 0; i < state->vals.size(); i++) {
+            const int s = series_idx[state->first_signal_id + i];
+            if (s >= 0) {
+              series[s].times.push_back(sec);
+              series[s].values.push_back(state->vals[i]);
+            }
+            // every value already went to the series
+            state->all_vals[i].clear();
+          }
+        }
+      }
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception &e) {
+    WARN("failed to parse log: %s\n", e.getDescription().cStr());
+  }
+  return series;
+}
+
+std::vector<SignalSeries> decode_logs(int bus, const std::string &dbc_name, const std::vector<SignalParseOptions> &signals,
+                                      const std::vector<LogData> &logs, bool sendcan, bool checks, int threads) {
+  const DBC *dbc = dbc_lookup(dbc_name);
+  assert(dbc);
+
+  // one message option per address, without frequency checks. unknown messages are skipped
+  // since CANParser asserts on them
+  std::vector<MessageParseOptions> options;
+  std::vector<SignalParseOptions> known_signals;
+  for (const auto &sig : signals) {
+    bool known = false;
+    for (int i = 0; i < dbc->num_msgs && !known; i++) {
+      known = dbc->msgs[i].address == sig.address;
+    }
+    if (!known) {
+      WARN("decode_logs: could not find message 0x%X in DBC %s\n", sig.address, dbc_name.c_str());
+      continue;
+    }
+    known_signals.push_back(sig);
+    auto it = std::find_if(options.begin(), options.end(), [&](auto &op) { return op.address == sig.address; });
+    if (it == options.end()) {
+      options.push_back({.address = sig.address, .check_frequency = 0});
+    }
+  }
+
+  std::vector<std::vector<SignalSeries>> log_series(logs.size());
+  std::atomic<int> next_log = 0;
+  auto worker = [&]() {
+    for (int i = next_log++; i < logs.size(); i = next_log++) {
+      log_series[i] = decode_log(bus, dbc_name, known_signals, options, logs[i], sendcan, checks);
+    }
+  };
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<std::thread> pool;
+  for (int i = 0; i < std::min<int>(threads, logs.size()); i++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) t.join();
+
+  std::vector<SignalSeries> ret;
+  for (const auto &sig : signals) {
+    ret.push_back({.address = sig.address, .name = sig.name});
+  }
+  for (int s = 0; s < known_signals.size(); s++) {
+    auto out = std::find_if(ret.begin(), ret.end(), [&](auto &r) {
+      return r.address == known_signals[s].address && strcmp(r.name, known_signals[s].name) == 0;
+    });
+    for (const auto &series : log_series) {
+      out->times.insert(out->times.end(), series[s].times.begin(), series[s].times.end());
+      out->values.insert(out->values.end(), series[s].values.begin(), series[s].values.end());
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#include "common.h"
+#include "selfdrive/common/benchmark.h"
+
+// end to end benchmark of a car's CAN stack: replays can events through CANParser::UpdateCans,
+// UpdateValid and query_latest as controlsd does every cycle, and packs every message of the DBC
+// with CANPacker::pack. reports ns per frame and per signal, and heap allocations, per stage.
+// without a log, every DBC is run on synthetic traffic that holds each of its messages once per
+// event, packed with random values and incrementing counters. with a decompressed rlog, the can
+// events of the log are run through the given DBC with checksum and counter checks enabled.
+// usage: can_benchmark [iterations]
+//        can_benchmark <rlog> <dbc> [bus] [iterations]
+
+const int SYNTHETIC_EVENTS = 100;
+
+struct Event {
+  kj::Array<capnp::word> words;
+  std::unique_ptr<capnp::FlatArrayMessageReader> reader;
+};
+
+static Event make_event(kj::Array<capnp::word> words) {
+  // events are read once per iteration, so lift the traversal limit
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+  auto reader = std::make_unique<capnp::FlatArrayMessageReader>(words.asPtr(), options);
+  return {std::move(words), std::move(reader)};
+}
+
+// every message of the DBC on bus 0 in each event, with random signal values and a counter
+static std::vector<Event> synthetic_events(const DBC *dbc, std::mt19937 &gen) {
+  CANPacker packer(dbc->name);
+  std::vector<Event> events;
+  for (int e = 0; e < SYNTHETIC_EVENTS; e++) {
+    capnp::MallocMessageBuilder msg(1 << 16);
+    auto event = msg.initRoot<cereal::Event>();
+    event.setLogMonoTime((e + 1) * 10000000ULL);  // 100 Hz
+    auto can = event.initCan(dbc->num_msgs);
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &m = dbc->msgs[i];
+      std::vector<SignalHandleValue> values;
+      for (int j = 0; j < m.num_sigs; j++) {
+        const Signal &sig = m.sigs[j];
+        const int64_t raw = gen() & ((1ULL << std::min(sig.size, 31)) - 1);
+        values.push_back({packer.signal_handle(m.address, sig.name), raw * sig.factor + sig.offset});
+      }
+      const std::vector<uint8_t> dat = packer.pack(m.address, values, e);
+      can[i].setAddress(m.address);
+      can[i].setSrc(0);
+      can[i].setDat(kj::arrayPtr(dat.data(), dat.size()));
+    }
+    events.push_back(make_event(capnp::messageToFlatArray(msg)));
+  }
+  return events;
+}
+
+static std::vector<Event> log_events(const std::string &log) {
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(log.size() / sizeof(capnp::word));
+  memcpy(buf.begin(), log.data(), buf.size() * sizeof(capnp::word));
+
+  std::vector<Event> events;
+  kj::ArrayPtr<const capnp::word> words = buf.asPtr();
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    const auto end = reader.getEnd();
+    if (reader.getRoot<cereal::Event>().isCan()) {
+      events.push_back(make_event(kj::heapArray<capnp::word>(words.begin(), end - words.begin())));
+    }
+    words = kj::arrayPtr(end, words.end());
+  }
+  return events;
+}
+
+static void run(const DBC *dbc, int bus, const std::vector<Event> &events, bool checks, int iterations) {
+  // update counts frames, the others calls
+  benchmark::Stage update, valid, query, pack;
+  CANParser parser(bus, dbc->name, !checks, !checks);
+  std::vector<SignalValue> latest;
+
+  auto replay = [&](benchmark::Stage &u, benchmark::Stage &v, benchmark::Stage &q) {
+    size_t signals = 0;
+    for (const Event &e : events) {
+      auto event = e.reader->getRoot<cereal::Event>();
+      const uint64_t sec = event.getLogMonoTime();
+      const auto cans = event.getCan();
+      benchmark::measure(u, [&]() {
+        parser.UpdateCans(sec, cans);
+        return cans.size();
+      });
+      parser.last_sec = sec;
+      benchmark::measure(v, [&]() {
+        parser.UpdateValid(sec);
+        return 1;
+      });
+      benchmark::measure(q, [&]() {
+        signals += parser.query_latest(latest);
+        return 1;
+      });
+    }
+    return signals;
+  };
+
+  // the first pass grows all_vals and is not counted
+  benchmark::Stage warmup[3];
+  replay(warmup[0], warmup[1], warmup[2]);
+  uint64_t signals = 0;
+  for (int it = 0; it < iterations; it++) {
+    signals += replay(update, valid, query);
+  }
+  const uint64_t frames = update.count;
+
+  CANPacker packer(dbc->name);
+  std::vector<std::vector<SignalHandleValue>> values(dbc->num_msgs);
+  for (int i = 0; i < dbc->num_msgs; i++) {
+    const Msg &m = dbc->msgs[i];
+    for (int j = 0; j < m.num_sigs; j++) {
+      values[i].push_back({packer.signal_handle(m.address, m.sigs[j].name), 0});
+    }
+  }
+  for (int it = 0; it < iterations; it++) {
+    benchmark::measure(pack, [&]() {
+      for (int i = 0; i < dbc->num_msgs; i++) packer.pack(dbc->msgs[i].address, values[i], it);
+      return dbc->num_msgs;
+    });
+  }
+
+  // ns per signal of the parser, over the signals that query_latest returned
+  const double update_ns = update.total_ns(), valid_ns = valid.total_ns(), query_ns = query.total_ns();
+  const double parse_ns = update_ns + valid_ns + query_ns, pack_ns = pack.total_ns();
+  printf("%-44s %8lu %10.1f %10.1f %8lu %10.1f %8lu %10.1f %8lu %10.1f %8lu\n", dbc->name, frames,
+         frames ? update_ns / frames : 0, signals ? parse_ns / signals : 0, update.allocs,
+         valid.count ? valid_ns / valid.count : 0, valid.allocs, query.count ? query_ns / query.count : 0, query.allocs,
+         pack.count ? pack_ns / pack.count : 0, pack.allocs);
+}
+
+static void print_header() {
+  printf("%-44s %8s %10s %10s %8s %10s %8s %10s %8s %10s %8s\n", "dbc", "frames", "ns/frame", "ns/signal", "allocs",
+         "valid ns", "allocs", "query ns", "allocs", "pack ns", "allocs");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 2) {
+    const DBC *dbc = dbc_lookup(argv[2]);
+    if (!dbc) {
+      printf("missing DBC %s\n", argv[2]);
+      return 1;
+    }
+    std::ifstream f(argv[1], std::ios::binary);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const std::vector<Event> events = log_events(ss.str());
+    if (events.empty()) {
+      printf("no can events in %s\n", argv[1]);
+      return 1;
+    }
+    print_header();
+    run(dbc, argc > 3 ? atoi(argv[3]) : 0, events, true, argc > 4 ? atoi(argv[4]) : 10);
+    return 0;
+  }
+
+  const int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  std::mt19937 gen(0);
+  print_header();
+  for (const DBC *dbc : get_dbcs()) {
+    // checks are off, not every checksum signal of every DBC can be packed
+    run(dbc, 0, synthetic_events(dbc, gen), false, iterations);
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "common.h"
+
+// checksums per second of every checksum algorithm, for the bitwise reference implementation,
+// the table driven one through its ChecksumFunc, and validate_checksums on a batch of frames.
+// the table driven results must match the references, and every batch frame must be valid.
+// empty and one byte frames of every message must fail parsing without reading past their end.
+// usage: checksum_benchmark [iterations]
+
+const int NUM_FRAMES = 1024;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint8_t crc8_bitwise(uint8_t poly, uint8_t crc, const uint8_t *d, int n, bool reverse = false) {
+  for (int i = 0; i < n; i++) {
+    crc ^= d[reverse ? n - 1 - i : i];
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static unsigned int chrysler_reference(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
+  uint8_t checksum = 0xFF;
+  for (int j = 0; j < (d.size() - 1); j++) {
+    uint8_t shift = 0x80;
+    uint8_t curr = d[j];
+    for (int i = 0; i < 8; i++) {
+      uint8_t bit_sum = curr & shift;
+      uint8_t temp_chk = checksum & 0x80U;
+      if (bit_sum != 0U) {
+        bit_sum = 0x1C;
+        if (temp_chk != 0U) {
+          bit_sum = 1;
+        }
+        checksum = checksum << 1;
+        temp_chk = checksum | 1U;
+        bit_sum ^= temp_chk;
+      } else {
+        if (temp_chk != 0U) {
+          bit_sum = 0x1D;
+        }
+        checksum = checksum << 1;
+        bit_sum ^= checksum;
+      }
+      checksum = bit_sum;
+      shift = shift >> 1;
+    }
+  }
+  return ~checksum & 0xFF;
+}
+
+// only valid for LWI_01 (0x86), whose magic padding byte is 0x86 for every counter
+static unsigned int volkswagen_reference(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
+  uint8_t crc = crc8_bitwise(0x2F, 0xFF, d.begin() + 1, d.size() - 1);
+  const uint8_t magic = 0x86;
+  return crc8_bitwise(0x2F, crc, &magic, 1) ^ 0xFF;
+}
+
+static unsigned int pedal_reference(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
+  return crc8_bitwise(0xD5, 0xFF, d.begin(), d.size() - 1, true);
+}
+
+struct Case {
+  const char *name;
+  SignalType type;
+  uint32_t address;
+  int size;
+  ChecksumFunc reference;  // the table driven function itself if there is nothing to compare against
+};
+
+static Signal checksum_signal(const Case &c) {
+  // in the first byte for volkswagen and subaru, the low nibble of the last byte for honda, else the last byte
+  const bool first = c.type == SignalType::VOLKSWAGEN_CHECKSUM || c.type == SignalType::SUBARU_CHECKSUM;
+  const int byte = first ? 0 : c.size - 1;
+  const int size = c.type == SignalType::HONDA_CHECKSUM ? 4 : 8;
+  return {.name = "CHECKSUM", .start_bit = byte * 8 + size - 1, .msb = byte * 8 + size - 1, .lsb = byte * 8,
+          .size = size, .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = false, .type = c.type};
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  std::mt19937 gen(0);
+  init_crc_lookup_tables();
+
+  const Case cases[] = {
+    {"honda", SignalType::HONDA_CHECKSUM, 0x1D0, 8, honda_checksum},
+    {"toyota", SignalType::TOYOTA_CHECKSUM, 0x2E4, 8, toyota_checksum},
+    {"subaru", SignalType::SUBARU_CHECKSUM, 0x119, 8, subaru_checksum},
+    {"chrysler", SignalType::CHRYSLER_CHECKSUM, 0x292, 8, chrysler_reference},
+    {"volkswagen", SignalType::VOLKSWAGEN_CHECKSUM, 0x86, 8, volkswagen_reference},
+    {"pedal", SignalType::PEDAL_CHECKSUM, 0x200, 6, pedal_reference},
+    // CAN FD sized frames, where slicing the CRC pays off most
+    {"chrysler (64 bytes)", SignalType::CHRYSLER_CHECKSUM, 0x292, 64, chrysler_reference},
+    {"volkswagen (64 bytes)", SignalType::VOLKSWAGEN_CHECKSUM, 0x86, 64, volkswagen_reference},
+  };
+
+  printf("%-24s %16s %16s %16s\n", "algorithm", "bitwise (/s)", "table (/s)", "batch (/s)");
+  uint64_t failures = 0;
+  for (const Case &c : cases) {
+    const ChecksumFunc checksum = get_checksum_func(c.type);
+    const Signal sig = checksum_signal(c);
+
+    // random frames with a valid checksum filled in
+    std::vector<uint8_t> frames(NUM_FRAMES * c.size);
+    for (auto &b : frames) b = gen();
+    const uint8_t *data = frames.data();
+    for (int i = 0; i < NUM_FRAMES; i++) {
+      const kj::ArrayPtr<const uint8_t> dat(data + i * c.size, c.size);
+      frames[i * c.size + sig.lsb / 8] &= ~((1 << sig.size) - 1);
+      frames[i * c.size + sig.lsb / 8] |= checksum(c.address, dat);
+      if (checksum(c.address, dat) != c.reference(c.address, dat)) {
+        printf("%s: checksum of frame %d does not match the reference\n", c.name, i);
+        failures++;
+      }
+    }
+
+    unsigned int sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+      for (int i = 0; i < NUM_FRAMES; i++) sink += c.reference(c.address, kj::arrayPtr(data + i * c.size, c.size));
+    }
+    const double t_reference = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+      for (int i = 0; i < NUM_FRAMES; i++) sink -= checksum(c.address, kj::arrayPtr(data + i * c.size, c.size));
+    }
+    const double t_table = seconds_since(start);
+
+    bool valid[NUM_FRAMES];
+    size_t num_valid = 0;
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+      num_valid += validate_checksums(sig, c.address, data, c.size, NUM_FRAMES, valid);
+    }
+    const double t_batch = seconds_since(start);
+
+    if (sink != 0 || num_valid != (size_t)NUM_FRAMES * iterations) {
+      printf("%s: %zu of %zu frames valid\n", c.name, num_valid, (size_t)NUM_FRAMES * iterations);
+      failures++;
+    }
+
+    const double n = (double)NUM_FRAMES * iterations;
+    printf("%-24s %16.0f %16.0f %16.0f\n", c.name, n / t_reference, n / t_table, n / t_batch);
+  }
+
+  // a malformed frame on the bus, shorter than its message, is invalid and must not crash the parser
+  const uint8_t short_frame[1] = {0xFF};
+  for (const Case &c : cases) {
+    MessageState state = {.address = c.address, .size = (unsigned int)c.size, .parse_sigs = {checksum_signal(c)}};
+    state.vals.resize(1);
+    state.all_vals.resize(1);
+    state.init_checks();
+    for (size_t len : {0, 1}) {
+      get_checksum_func(c.type)(c.address, kj::arrayPtr(short_frame, len));
+      if (state.parse(0, kj::arrayPtr(short_frame, len))) {
+        printf("%s: %zu byte frame parsed as valid\n", c.name, len);
+        failures++;
+      }
+    }
+  }
+  return failures > 0;
+}
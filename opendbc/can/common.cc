@@ -1,6 +1,31 @@
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
 #include "common.h"
 
-unsigned int honda_checksum(uint32_t address, const std::vector<uint8_t> &d) {
+// Static lookup tables for fast computation of CRC8, sliced by 8: crc8_lut_x[k][b] is the CRC of
+// byte b followed by k zero bytes, so up to 8 bytes are folded with independent lookups
+uint8_t crc8_lut_8h2f[8][256];  // CRC-8 8H2F/AUTOSAR, poly 0x2F
+uint8_t crc8_lut_j1850[8][256];  // CRC-8 SAE J1850, poly 0x1D
+uint8_t crc8_lut_pedal[8][256];  // poly 0xD5
+
+// folds n bytes into crc, 8 at a time through the sliced tables
+static inline uint8_t crc8_slice(const uint8_t lut[8][256], uint8_t crc, const uint8_t *d, size_t n) {
+  while (n > 0) {
+    const size_t m = std::min<size_t>(n, 8);
+    uint8_t c = lut[m - 1][crc ^ d[0]];
+    for (size_t j = 1; j < m; j++) {
+      c ^= lut[m - 1 - j][d[j]];
+    }
+    crc = c;
+    d += m;
+    n -= m;
+  }
+  return crc;
+}
+
+unsigned int honda_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
   int s = 0;
   while (address) { s += (address & 0xF); address >>= 4; }
   for (int i = 0; i < d.size(); i++) {
@@ -14,15 +39,15 @@ unsigned int honda_checksum(uint32_t address, const std::vector<uint8_t> &d) {
   return s & 0xF;
 }
 
-unsigned int toyota_checksum(uint32_t address, const std::vector<uint8_t> &d) {
+unsigned int toyota_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
   unsigned int s = d.size();
   while (address) { s += address & 0xFF; address >>= 8; }
-  for (int i = 0; i < d.size() - 1; i++) { s += d[i]; }
+  for (int i = 0; i + 1 < d.size(); i++) { s += d[i]; }
 
   return s & 0xFF;
 }
 
-unsigned int subaru_checksum(uint32_t address, const std::vector<uint8_t> &d) {
+unsigned int subaru_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
   unsigned int s = 0;
   while (address) { s += address & 0xFF; address >>= 8; }
 
@@ -32,41 +57,14 @@ unsigned int subaru_checksum(uint32_t address, const std::vector<uint8_t> &d) {
   return s & 0xFF;
 }
 
-unsigned int chrysler_checksum(uint32_t address, const std::vector<uint8_t> &d) {
+unsigned int chrysler_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
   /* jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf */
-  uint8_t checksum = 0xFF;
-  for (int j = 0; j < (d.size() - 1); j++) {
-    uint8_t shift = 0x80;
-    uint8_t curr = d[j];
-    for (int i = 0; i < 8; i++) {
-      uint8_t bit_sum = curr & shift;
-      uint8_t temp_chk = checksum & 0x80U;
-      if (bit_sum != 0U) {
-        bit_sum = 0x1C;
-        if (temp_chk != 0U) {
-          bit_sum = 1;
-        }
-        checksum = checksum << 1;
-        temp_chk = checksum | 1U;
-        bit_sum ^= temp_chk;
-      } else {
-        if (temp_chk != 0U) {
-          bit_sum = 0x1D;
-        }
-        checksum = checksum << 1;
-        bit_sum ^= checksum;
-      }
-      checksum = bit_sum;
-      shift = shift >> 1;
-    }
-  }
-  return ~checksum & 0xFF;
+  // this is CRC8 SAE J1850, poly 0x1D with init and final XOR 0xFF, over all bytes but the checksum
+  if (d.size() < 1) return 0;  // no checksum byte, MessageState::parse fails such frames
+  return crc8_slice(crc8_lut_j1850, 0xFF, d.begin(), d.size() - 1) ^ 0xFF;
 }
 
-// Static lookup table for fast computation of CRC8 poly 0x2F, aka 8H2F/AUTOSAR
-uint8_t crc8_lut_8h2f[256];
-
-void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
+void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[8][256]) {
   uint8_t crc;
   int i, j;
 
@@ -78,28 +76,37 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
       else
         crc <<= 1;
     }
-    crc_lut[i] = crc;
+    crc_lut[0][i] = crc;
+  }
+  for (int k = 1; k < 8; k++) {
+    for (i = 0; i < 256; i++) {
+      crc_lut[k][i] = crc_lut[0][crc_lut[k - 1][i]];
+    }
   }
 }
 
 void init_crc_lookup_tables() {
   // At init time, set up static lookup tables for fast CRC computation.
-
-  gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  // Parsers may be created on several threads, see decode_logs.
+  static std::once_flag once;
+  std::call_once(once, []() {
+    gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+    gen_crc_lookup_table(0x1D, crc8_lut_j1850);   // CRC-8 SAE J1850 for Chrysler
+    gen_crc_lookup_table(0xD5, crc8_lut_pedal);   // CRC-8 for the comma pedal
+  });
 }
 
-unsigned int volkswagen_crc(uint32_t address, const std::vector<uint8_t> &d) {
+unsigned int volkswagen_crc(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
   // Volkswagen uses standard CRC8 8H2F/AUTOSAR, but they compute it with
   // a magic variable padding byte tacked onto the end of the payload.
   // https://www.autosar.org/fileadmin/user_upload/standards/classic/4-3/AUTOSAR_SWS_CRCLibrary.pdf
 
+  if (d.size() < 2) return 0;  // no room for the checksum and counter, MessageState::parse fails such frames
+
   uint8_t crc = 0xFF; // Standard init value for CRC8 8H2F/AUTOSAR
 
   // CRC the payload first, skipping over the first byte where the CRC lives.
-  for (int i = 1; i < d.size(); i++) {
-    crc ^= d[i];
-    crc = crc8_lut_8h2f[crc];
-  }
+  crc = crc8_slice(crc8_lut_8h2f, crc, d.begin() + 1, d.size() - 1);
 
   // Look up and apply the magic final CRC padding byte, which permutes by CAN
   // address, and additionally (for SOME addresses) by the message counter.
@@ -164,25 +171,84 @@ unsigned int volkswagen_crc(uint32_t address, const std::vector<uint8_t> &d) {
       crc ^= (uint8_t[]){0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}[counter];
       break;
   }
-  crc = crc8_lut_8h2f[crc];
+  crc = crc8_lut_8h2f[0][crc];
 
   return crc ^ 0xFF; // Return after standard final XOR for CRC8 8H2F/AUTOSAR
 }
 
-unsigned int pedal_checksum(const std::vector<uint8_t> &d) {
-  uint8_t crc = 0xFF;
-  uint8_t poly = 0xD5; // standard crc8
+unsigned int pedal_checksum(kj::ArrayPtr<const uint8_t> d) {
+  // standard crc8, poly 0xD5, over the bytes before the checksum byte in reverse order
+  if (d.size() < 1) return 0;  // no checksum byte, MessageState::parse fails such frames
+  uint8_t rev[64];
+  const int n = d.size() - 1;
+  for (int i = 0; i < n; i++) {
+    rev[i] = d[n - 1 - i];
+  }
+  return crc8_slice(crc8_lut_pedal, 0xFF, rev, n);
+}
 
-  // skip checksum byte
-  for (int i = d.size()-2; i >= 0; i--) {
-    crc ^= d[i];
-    for (int j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      } else {
-        crc <<= 1;
+static unsigned int pedal_checksum_address(uint32_t address, kj::ArrayPtr<const uint8_t> d) {
+  return pedal_checksum(d);
+}
+
+ChecksumFunc get_checksum_func(SignalType type) {
+  switch (type) {
+    case SignalType::HONDA_CHECKSUM: return honda_checksum;
+    case SignalType::TOYOTA_CHECKSUM: return toyota_checksum;
+    case SignalType::VOLKSWAGEN_CHECKSUM: return volkswagen_crc;
+    case SignalType::SUBARU_CHECKSUM: return subaru_checksum;
+    case SignalType::CHRYSLER_CHECKSUM: return chrysler_checksum;
+    case SignalType::PEDAL_CHECKSUM: return pedal_checksum_address;
+    default: return nullptr;
+  }
+}
+
+size_t validate_checksums(const Signal &sig, uint32_t address, const uint8_t *frames, size_t size, size_t count, bool *valid) {
+  ChecksumFunc checksum = get_checksum_func(sig.type);
+  assert(checksum);
+
+  size_t num_valid = 0;
+  for (size_t i = 0; i < count; i++) {
+    const kj::ArrayPtr<const uint8_t> dat(frames + i * size, size);
+    valid[i] = checksum(address, dat) == get_raw_value(dat, sig);
+    num_valid += valid[i];
+  }
+  return num_valid;
+}
+
+void AddressTable::build(const std::vector<uint32_t> &addresses) {
+  std_index.assign(0x800, -1);
+  std::vector<std::pair<uint32_t, int>> ext;
+  for (int i = 0; i < addresses.size(); i++) {
+    if (addresses[i] < std_index.size()) {
+      std_index[addresses[i]] = i;
+    } else {
+      ext.push_back({addresses[i], i});
+    }
+  }
+  if (ext.empty()) return;
+
+  // search odd multipliers until the extended ids land in distinct slots, growing the table if needed
+  uint32_t seed = 0x9E3779B9;
+  for (int bits = 1; ; bits++) {
+    if ((1u << bits) < ext.size() * 2) continue;
+    ext_shift = 32 - bits;
+    for (int attempt = 0; attempt < 1000; attempt++) {
+      ext_mult = seed | 1;
+      seed = seed * 1664525 + 1013904223;
+      ext_keys.assign(1u << bits, 0);
+      ext_index.assign(1u << bits, -1);
+      bool collision = false;
+      for (const auto &[address, i] : ext) {
+        const uint32_t h = (address * ext_mult) >> ext_shift;
+        if (ext_index[h] != -1) {
+          collision = true;
+          break;
+        }
+        ext_keys[h] = address;
+        ext_index[h] = i;
       }
+      if (!collision) return;
     }
   }
-  return crc;
 }
@@ -18,15 +18,46 @@
 //#define DEBUG printf
 
 #define MAX_BAD_COUNTER 5
+// values per signal kept between two query_latest calls before all_vals has to grow
+#define ALL_VALS_RESERVE 8
 
 // Car specific functions
-unsigned int honda_checksum(uint32_t address, const std::vector<uint8_t> &d);
-unsigned int toyota_checksum(uint32_t address, const std::vector<uint8_t> &d);
-unsigned int subaru_checksum(uint32_t address, const std::vector<uint8_t> &d);
-unsigned int chrysler_checksum(uint32_t address, const std::vector<uint8_t> &d);
+unsigned int honda_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d);
+unsigned int toyota_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d);
+unsigned int subaru_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d);
+unsigned int chrysler_checksum(uint32_t address, kj::ArrayPtr<const uint8_t> d);
 void init_crc_lookup_tables();
-unsigned int volkswagen_crc(uint32_t address, const std::vector<uint8_t> &d);
-unsigned int pedal_checksum(const std::vector<uint8_t> &d);
+unsigned int volkswagen_crc(uint32_t address, kj::ArrayPtr<const uint8_t> d);
+unsigned int pedal_checksum(kj::ArrayPtr<const uint8_t> d);
+
+// checksum of a frame for one of the *_CHECKSUM signal types, resolved once per message
+typedef unsigned int (*ChecksumFunc)(uint32_t address, kj::ArrayPtr<const uint8_t> d);
+ChecksumFunc get_checksum_func(SignalType type);
+// validates count frames of the same message stored back to back, size bytes apart.
+// sets valid[i] for each frame and returns the number of valid frames
+size_t validate_checksums(const Signal &sig, uint32_t address, const uint8_t *frames, size_t size, size_t count, bool *valid);
+
+int64_t get_raw_value(kj::ArrayPtr<const uint8_t> msg, const Signal &sig);
+
+// maps the CAN addresses of a DBC to indices. 11-bit ids index a flat table directly,
+// larger ids go through a multiplicative perfect hash built for the known set.
+class AddressTable {
+public:
+  void build(const std::vector<uint32_t> &addresses);
+  inline int find(uint32_t address) const {
+    if (address < std_index.size()) return std_index[address];
+    if (ext_keys.empty()) return -1;
+    const uint32_t h = (address * ext_mult) >> ext_shift;
+    return ext_keys[h] == address ? ext_index[h] : -1;
+  }
+
+private:
+  std::vector<int16_t> std_index;
+  std::vector<uint32_t> ext_keys;
+  std::vector<int16_t> ext_index;
+  uint32_t ext_mult = 0;
+  int ext_shift = 0;
+};
 
 class MessageState {
 public:
@@ -34,6 +65,7 @@ public:
   unsigned int size;
 
   std::vector<Signal> parse_sigs;
+  std::vector<int> sig_index;  // index of each parse_sig in the DBC message
   std::vector<double> vals;
   std::vector<std::vector<double>> all_vals;
 
@@ -43,25 +75,50 @@ public:
   uint8_t counter;
   uint8_t counter_fail;
 
+  int first_signal_id;  // id of parse_sigs[0] in the parser's signal buffers
+
   bool ignore_checksum = false;
   bool ignore_counter = false;
 
-  bool parse(uint64_t sec, const std::vector<uint8_t> &dat);
+  // index in parse_sigs of the checksum and counter signals, -1 if the message has none
+  int checksum_idx = -1;
+  int counter_idx = -1;
+  ChecksumFunc checksum = nullptr;
+
+  // generated decoder for all signals of the message, get_raw_value is the fallback
+  MsgDecoder decode = nullptr;
+  std::vector<int64_t> raw_vals;
+
+  // resolves the checksum and counter signals once parse_sigs is filled
+  void init_checks();
+  bool parse(uint64_t sec, kj::ArrayPtr<const uint8_t> dat);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
 
 class CANParser {
 private:
+  friend class CANDispatcher;
   const int bus;
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+  std::vector<MessageState> message_states;
+  AddressTable message_index;
+  std::vector<uint8_t> signal_changed;
+  size_t num_changed = 0;
+
+  void init_signal_buffers();
 
 public:
   bool can_valid = false;
   uint64_t last_sec = 0;
 
+  // latest value and update time of every parsed signal, indexed by a signal id that is
+  // stable for the lifetime of the parser. the buffers are never resized.
+  std::vector<double> signal_values;
+  std::vector<uint64_t> signal_times;
+  std::vector<int> changed_ids;
+
   CANParser(int abus, const std::string& dbc_name,
             const std::vector<MessageParseOptions> &options,
             const std::vector<SignalParseOptions> &sigoptions);
@@ -71,18 +128,95 @@ public:
   void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
+  // returns the state of the message if the frame was parsed and passed its checks
+  MessageState *UpdateFrame(uint64_t sec, uint32_t address, kj::ArrayPtr<const uint8_t> dat);
+  // turns the checksum and counter checks of every message on or off
+  void set_checks(bool checksum, bool counter);
   void UpdateValid(uint64_t sec);
-  std::vector<SignalValue> query_latest();
+  // fills vals with the latest value, and the values since the last call, of every signal of the messages
+  // updated at last_sec, and returns how many it filled. vals keeps its elements and their capacity from
+  // call to call, so once it has grown this doesn't allocate
+  size_t query_latest(std::vector<SignalValue> &vals);
+  // address and name of each signal id
+  std::vector<SignalParseOptions> signal_ids() const;
+  // returns n, the first n changed_ids are the signals whose value changed since the last call.
+  // also drops the values kept for query_latest, use one or the other
+  size_t query_changed();
+};
+
+#ifndef DYNAMIC_CAPNP
+// reads each can event once and hands every frame only to the parsers on its bus,
+// instead of each parser decoding the event and skipping the other buses itself
+class CANDispatcher {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser *> parsers;
+  std::vector<std::vector<CANParser *>> bus_parsers;  // indexed by bus
+
+public:
+  CANDispatcher(const std::vector<CANParser *> &parsers);
+  void update_string(const std::string &data, bool sendcan);
+};
+
+struct SignalSeries {
+  uint32_t address;
+  const char* name;
+  std::vector<uint64_t> times;
+  std::vector<double> values;
+};
+
+// a raw (decompressed) rlog owned by the caller, word aligned
+struct LogData {
+  const char *data;
+  size_t size;
+};
+
+// decodes every value of the requested signals from the can events of whole logs into one
+// time series per signal, in the order of signals. each log is decoded on its own thread with
+// its own parser, and the series are concatenated in log order. with checks, frames that fail
+// their checksum or counter check are left out of the series, as CANParser drops them.
+std::vector<SignalSeries> decode_logs(int bus, const std::string &dbc_name, const std::vector<SignalParseOptions> &signals,
+                                      const std::vector<LogData> &logs, bool sendcan, bool checks, int threads = 0);
+#endif
+
+// a message and an ordered list of its signals, resolved once by CANPacker::pack_plan.
+// only valid for the packer that made it
+struct PackPlan {
+  int msg_idx = -1;  // -1 if the message is not in the DBC
+  uint32_t address = 0;
+  unsigned int size = 0;
+  std::vector<int> handles;  // one per value, -1 for undefined signals, which are skipped
 };
 
 class CANPacker {
 private:
+  struct MessagePack {
+    Msg msg;
+    int first_signal = 0;  // handle of the first signal of the message, the others follow
+    int counter = -1;  // signal handles, -1 if the message has none
+    int checksum = -1;
+    ChecksumFunc checksum_func = nullptr;
+  };
+
   const DBC *dbc = NULL;
-  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
-  std::map<uint32_t, Msg> message_lookup;
+  std::map<std::pair<uint32_t, std::string>, int> signal_lookup;
+  std::vector<Signal> signals;
+  std::vector<MessagePack> messages;
+  AddressTable message_index;
+
+  void set_counter_and_checksum(const MessagePack &m, kj::ArrayPtr<uint8_t> dat, int counter) const;
 
 public:
   CANPacker(const std::string& dbc_name);
   std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
+  // resolve a signal once with signal_handle, then pack without string lookups
+  int signal_handle(uint32_t address, const std::string &name) const;
+  std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalHandleValue> &values, int counter);
+  // resolve a message and its signals once with pack_plan, then pack the values of the signals,
+  // in plan order, into out which holds plan.size bytes. returns false for undefined messages
+  PackPlan pack_plan(uint32_t address, const std::vector<std::string> &signal_names) const;
+  bool pack(const PackPlan &plan, const double *values, int counter, uint8_t *out) const;
+  // nullptr for an address that is not in the DBC. before the address tables this returned an empty
+  // Msg, callers like PlotJuggler have to check
   Msg* lookup_message(uint32_t address);
 };
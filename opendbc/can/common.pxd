@@ -68,16 +68,50 @@ cdef extern from "common_dbc.h":
     string name
     double value
 
+  cdef struct SignalHandleValue:
+    int handle
+    double value
+
 
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string);
 
   cdef cppclass CANParser:
     bool can_valid
+    vector[double] signal_values
+    vector[uint64_t] signal_times
+    vector[int] changed_ids
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_string(string, bool)
-    vector[SignalValue] query_latest()
+    size_t query_latest(vector[SignalValue]&)
+    vector[SignalParseOptions] signal_ids()
+    size_t query_changed()
+
+  cdef cppclass CANDispatcher:
+    CANDispatcher(vector[CANParser *])
+    void update_string(string, bool)
+
+  cdef struct SignalSeries:
+    uint32_t address
+    const char* name
+    vector[uint64_t] times
+    vector[double] values
+
+  cdef struct LogData:
+    const char* data
+    size_t size
+
+  vector[SignalSeries] decode_logs(int, string, vector[SignalParseOptions], vector[LogData], bool, bool, int) nogil
+
+  cdef cppclass PackPlan:
+    uint32_t address
+    unsigned int size
+    vector[int] handles
 
   cdef cppclass CANPacker:
    CANPacker(string)
    vector[uint8_t] pack(uint32_t, vector[SignalPackValue], int counter)
+   vector[uint8_t] pack(uint32_t, vector[SignalHandleValue], int counter)
+   int signal_handle(uint32_t, string)
+   PackPlan pack_plan(uint32_t, vector[string])
+   bool pack_with_plan "pack"(PackPlan &, const double *, int, uint8_t *)
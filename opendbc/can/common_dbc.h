@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -12,6 +13,11 @@ struct SignalPackValue {
   double value;
 };
 
+struct SignalHandleValue {
+  int handle;  // from CANPacker::signal_handle
+  double value;
+};
+
 struct SignalParseOptions {
   uint32_t address;
   const char* name;
@@ -51,14 +57,30 @@ struct Signal {
   SignalType type;
 };
 
+// generated per message by dbc_template.cc. writes the raw, sign extended value of every signal
+// in Msg::sigs to raw. dat holds at least the message size plus MSG_DECODE_PADDING zero bytes.
+typedef void (*MsgDecoder)(const uint8_t *dat, int64_t *raw);
+#define MSG_DECODE_PADDING 8
+
 struct Msg {
   const char* name;
   uint32_t address;
   unsigned int size;
   size_t num_sigs;
   const Signal *sigs;
+  MsgDecoder decode;
 };
 
+inline uint64_t load_le64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t load_be64(const uint8_t *p) {
+  return __builtin_bswap64(load_le64(p));
+}
+
 struct Val {
   const char* name;
   uint32_t address;
@@ -74,12 +96,50 @@ struct DBC {
   size_t num_vals;
 };
 
-std::vector<const DBC*>& get_dbcs();
-const DBC* dbc_lookup(const std::string& dbc_name);
+// generated tables of a DBC, see dbc_template.cc. they hold no pointers but the few in DBCDef,
+// so they need no relocations and stay untouched in the library until the DBC is first looked up.
+// names are offsets into DBCDef::strings.
+struct SignalDef {
+  uint32_t name;
+  Signal sig;  // with a null name
+};
+
+struct MsgDef {
+  uint32_t name;
+  uint32_t address;
+  unsigned int size;
+  size_t num_sigs;
+  size_t first_sig;  // index in DBCDef::sigs
+};
 
-void dbc_register(const DBC* dbc);
+struct ValDef {
+  uint32_t name;
+  uint32_t address;
+  uint32_t def_val;
+  size_t first_sig;  // of the message
+};
 
-#define dbc_init(dbc) \
-static void __attribute__((constructor)) do_dbc_init_ ## dbc(void) { \
-  dbc_register(&dbc); \
-}
+struct DBCDef {
+  const char* name;
+  const char* strings;
+  size_t num_msgs;
+  const MsgDef *msgs;
+  MsgDecoder (*decoder)(size_t msg);
+  size_t num_sigs;
+  const SignalDef *sigs;
+  size_t num_vals;
+  const ValDef *vals;
+};
+
+// generated by process_registry
+struct DBCRegistryEntry {
+  const char* name;
+  const DBCDef *def;
+};
+extern const DBCRegistryEntry dbc_registry[];
+extern const size_t dbc_registry_size;
+
+// materializes the DBC on first lookup, the DBC is never freed. thread safe.
+const DBC* dbc_lookup(const std::string& dbc_name);
+// every DBC, loading all of them. for tools and benchmarks that go over all cars
+std::vector<const DBC*>& get_dbcs();
@@ -1,23 +1,88 @@
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 #include <vector>
 
 #include "common_dbc.h"
 
-std::vector<const DBC*>& get_dbcs() {
-  static std::vector<const DBC*> vec;
-  return vec;
+namespace {
+
+struct LoadedDBC {
+  DBC dbc;
+  std::vector<Msg> msgs;
+  std::vector<Signal> sigs;
+  std::vector<Val> vals;
+};
+
+std::mutex dbcs_lock;
+
+const DBC* load_dbc(const DBCDef *def) {
+  auto ret = new LoadedDBC;  // lives as long as the process, as the generated tables
+  ret->sigs.reserve(def->num_sigs);
+  for (int i = 0; i < def->num_sigs; i++) {
+    Signal sig = def->sigs[i].sig;
+    sig.name = def->strings + def->sigs[i].name;
+    ret->sigs.push_back(sig);
+  }
+  for (int i = 0; i < def->num_msgs; i++) {
+    const MsgDef &m = def->msgs[i];
+    ret->msgs.push_back({
+      .name = def->strings + m.name,
+      .address = m.address,
+      .size = m.size,
+      .num_sigs = m.num_sigs,
+      .sigs = &ret->sigs[m.first_sig],
+      .decode = def->decoder(i),
+    });
+  }
+  for (int i = 0; i < def->num_vals; i++) {
+    const ValDef &v = def->vals[i];
+    ret->vals.push_back({
+      .name = def->strings + v.name,
+      .address = v.address,
+      .def_val = def->strings + v.def_val,
+      .sigs = &ret->sigs[v.first_sig],
+    });
+  }
+  ret->dbc = {
+    .name = def->name,
+    .num_msgs = ret->msgs.size(),
+    .msgs = ret->msgs.data(),
+    .vals = ret->vals.data(),
+    .num_vals = ret->vals.size(),
+  };
+  return &ret->dbc;
+}
+
 }
 
 const DBC* dbc_lookup(const std::string& dbc_name) {
-  for (const auto& dbci : get_dbcs()) {
-    if (dbc_name == dbci->name) {
-      return dbci;
-    }
+  const DBCRegistryEntry *end = dbc_registry + dbc_registry_size;
+  const DBCRegistryEntry *entry = std::lower_bound(dbc_registry, end, dbc_name, [](const DBCRegistryEntry &e, const std::string &name) {
+    return strcmp(e.name, name.c_str()) < 0;
+  });
+  if (entry == end || dbc_name != entry->name) {
+    return NULL;
+  }
+
+  std::lock_guard lk(dbcs_lock);
+  static std::vector<const DBC*> loaded(dbc_registry_size);
+  const DBC *&dbc = loaded[entry - dbc_registry];
+  if (!dbc) {
+    dbc = load_dbc(entry->def);
   }
-  return NULL;
+  return dbc;
 }
 
-void dbc_register(const DBC* dbc) {
-  get_dbcs().push_back(dbc);
+std::vector<const DBC*>& get_dbcs() {
+  static std::vector<const DBC*> vec = []() {
+    std::vector<const DBC*> ret;
+    for (int i = 0; i < dbc_registry_size; i++) {
+      ret.push_back(dbc_lookup(dbc_registry[i].name));
+    }
+    return ret;
+  }();
+  return vec;
 }
 
 extern "C" {
@@ -0,0 +1,14 @@
+#include "common_dbc.h"
+
+{% for name in names %}
+extern const DBCDef {{name}}_def;
+{% endfor %}
+
+// sorted by name
+const DBCRegistryEntry dbc_registry[] = {
+{% for name in names %}
+  {"{{name}}", &{{name}}_def},
+{% endfor %}
+};
+
+const size_t dbc_registry_size = ARRAYSIZE(dbc_registry);
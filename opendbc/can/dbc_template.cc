@@ -2,11 +2,20 @@
 
 namespace {
 
+// names and value descriptions, referenced by offset so the tables below need no relocations
+const char strings[] =
+{% for s in strings %}
+  "{{s}}\0"
+{% endfor %}
+;
+
+const SignalDef sigs[] = {
 {% for address, msg_name, msg_size, sigs in msgs %}
-const Signal sigs_{{address}}[] = {
   {% for sig in sigs %}
-    {
-      .name = "{{sig.name}}",
+  {
+    .name = {{string_offset(sig.name)}},
+    .sig = {
+      .name = nullptr,
       .start_bit = {{sig.start_bit}},
       .msb  = {{sig.msb}},
       .lsb = {{sig.lsb}},
@@ -37,32 +46,51 @@ const Signal sigs_{{address}}[] = {
       .type = SignalType::DEFAULT,
       {% endif %}
     },
+  },
   {% endfor %}
+{% endfor %}
 };
+
+{% for address, msg_name, msg_size, sigs in msgs %}
+void decode_{{address}}(const uint8_t *dat, int64_t *raw) {
+  {% for sig in sigs %}
+  raw[{{loop.index0}}] = {{decode_expr(sig)}};
+  {% endfor %}
+}
 {% endfor %}
 
-const Msg msgs[] = {
+const MsgDef msgs[] = {
 {% for address, msg_name, msg_size, sigs in msgs %}
   {% set address_hex = "0x%X" % address %}
   {
-    .name = "{{msg_name}}",
+    .name = {{string_offset(msg_name)}},
     .address = {{address_hex}},
     .size = {{msg_size}},
-    .num_sigs = ARRAYSIZE(sigs_{{address}}),
-    .sigs = sigs_{{address}},
+    .num_sigs = {{sigs|length}},
+    .first_sig = {{first_sig[address]}},
   },
 {% endfor %}
 };
 
-const Val vals[] = {
+// a switch compiles to a relative jump table, unlike an array of function pointers
+MsgDecoder decoder(size_t msg) {
+  switch (msg) {
+  {% for address, msg_name, msg_size, sigs in msgs %}
+    case {{loop.index0}}: return decode_{{address}};
+  {% endfor %}
+    default: return nullptr;
+  }
+}
+
+const ValDef vals[] = {
 {% for address, sig in def_vals %}
   {% for sg_name, def_val in sig %}
     {% set address_hex = "0x%X" % address %}
     {
-      .name = "{{sg_name}}",
+      .name = {{string_offset(sg_name)}},
       .address = {{address_hex}},
-      .def_val = {{def_val}},
-      .sigs = sigs_{{address}},
+      .def_val = {{string_offset(raw_def_val(def_val))}},
+      .first_sig = {{first_sig[address]}},
     },
   {% endfor %}
 {% endfor %}
@@ -70,12 +98,15 @@ const Val vals[] = {
 
 }
 
-const DBC {{dbc.name}} = {
+extern const DBCDef {{dbc.name}}_def;
+const DBCDef {{dbc.name}}_def = {
   .name = "{{dbc.name}}",
+  .strings = strings,
   .num_msgs = ARRAYSIZE(msgs),
   .msgs = msgs,
-  .vals = vals,
+  .decoder = decoder,
+  .num_sigs = ARRAYSIZE(sigs),
+  .sigs = sigs,
   .num_vals = ARRAYSIZE(vals),
+  .vals = vals,
 };
-
-dbc_init({{dbc.name}})
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+
+#include "common.h"
+
+// time to load a DBC on its first dbc_lookup, address lookups per second of std::unordered_map
+// against AddressTable, and packs per second with signal names, signal handles and pack plans,
+// on traffic made of every message of a DBC plus unknown addresses from other ECUs. every address
+// must map to the same message in both, and the three ways of packing must give the same bytes.
+// usage: lookup_benchmark [iterations]
+
+const char *DBCS[] = {"hyundai_kia_generic", "toyota_nodsu_pt_generated", "honda_civic_touring_2016_can_generated"};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  std::mt19937 gen(0);
+
+  printf("%-40s %10s %16s %16s %16s %16s %16s\n", "dbc", "load (us)", "map (lookup/s)", "table (lookup/s)", "names (pack/s)",
+         "handles (pack/s)", "plans (pack/s)");
+  for (const char *name : DBCS) {
+    // the first lookup materializes the DBC from its generated tables
+    auto start = std::chrono::steady_clock::now();
+    const DBC *dbc = dbc_lookup(name);
+    const double t_load = seconds_since(start);
+    if (!dbc) {
+      printf("missing DBC %s\n", name);
+      return 1;
+    }
+
+    std::unordered_map<uint32_t, int> map;
+    std::vector<uint32_t> addresses;
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      map[dbc->msgs[i].address] = i;
+      addresses.push_back(dbc->msgs[i].address);
+    }
+    AddressTable table;
+    table.build(addresses);
+
+    // one in four frames is not in the DBC
+    std::vector<uint32_t> traffic = addresses;
+    for (int i = 0; i < addresses.size() / 3; i++) traffic.push_back(gen() % 0x800);
+    std::shuffle(traffic.begin(), traffic.end(), gen);
+
+    int mismatches = 0;
+    for (uint32_t address : traffic) {
+      auto map_it = map.find(address);
+      mismatches += table.find(address) != (map_it == map.end() ? -1 : map_it->second);
+    }
+    // and random extended ids, which go through the perfect hash
+    for (int i = 0; i < 100000; i++) {
+      const uint32_t address = 0x800 + gen() % (0x20000000 - 0x800);
+      mismatches += table.find(address) != (map.count(address) ? map[address] : -1);
+    }
+
+    int64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+      for (uint32_t address : traffic) {
+        auto map_it = map.find(address);
+        found += map_it == map.end() ? -1 : map_it->second;
+      }
+    }
+    const double t_map = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+      for (uint32_t address : traffic) {
+        found -= table.find(address);
+      }
+    }
+    const double t_table = seconds_since(start);
+    // uses the results, so the timed loops are not optimized out
+    mismatches += found != 0;
+
+    // pack every message with all of its signals
+    CANPacker packer(name);
+    std::vector<std::vector<SignalPackValue>> named(dbc->num_msgs);
+    std::vector<std::vector<SignalHandleValue>> handles(dbc->num_msgs);
+    std::vector<PackPlan> plans;
+    std::vector<std::vector<double>> values(dbc->num_msgs);
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      std::vector<std::string> names;
+      for (int j = 0; j < msg.num_sigs; j++) {
+        named[i].push_back({msg.sigs[j].name, 0});
+        handles[i].push_back({packer.signal_handle(msg.address, msg.sigs[j].name), 0});
+        names.push_back(msg.sigs[j].name);
+        values[i].push_back(0);
+      }
+      plans.push_back(packer.pack_plan(msg.address, names));
+
+      uint8_t planned[64] = {};
+      packer.pack(plans.back(), values[i].data(), -1, planned);
+      const std::vector<uint8_t> by_name = packer.pack(msg.address, named[i], -1);
+      const std::vector<uint8_t> by_handle = packer.pack(msg.address, handles[i], -1);
+      mismatches += by_name != by_handle || !std::equal(by_name.begin(), by_name.end(), planned);
+    }
+    if (mismatches > 0) {
+      printf("%s: %d lookups or packs disagree\n", name, mismatches);
+      return 1;
+    }
+    const int pack_iterations = std::max(iterations / 10, 1);
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < pack_iterations; it++) {
+      for (int i = 0; i < dbc->num_msgs; i++) packer.pack(dbc->msgs[i].address, named[i], -1);
+    }
+    const double t_names = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < pack_iterations; it++) {
+      for (int i = 0; i < dbc->num_msgs; i++) packer.pack(dbc->msgs[i].address, handles[i], -1);
+    }
+    const double t_handles = seconds_since(start);
+    uint8_t out[64];
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < pack_iterations; it++) {
+      for (int i = 0; i < dbc->num_msgs; i++) packer.pack(plans[i], values[i].data(), -1, out);
+    }
+    const double t_plans = seconds_since(start);
+
+    const double lookups = (double)traffic.size() * iterations, packs = (double)dbc->num_msgs * pack_iterations;
+    printf("%-40s %10.1f %16.0f %16.0f %16.0f %16.0f %16.0f\n", name, t_load * 1e6, lookups / t_map, lookups / t_table,
+           packs / t_names, packs / t_handles, packs / t_plans);
+  }
+  return 0;
+}
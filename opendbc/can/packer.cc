@@ -3,11 +3,12 @@
 #include <algorithm>
 #include <map>
 #include <cmath>
+#include <cstring>
 
 #include "common.h"
 
 
-void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+void set_value(kj::ArrayPtr<uint8_t> msg, const Signal &sig, int64_t ival) {
   int i = sig.lsb / 8;
   int bits = sig.size;
   if (sig.size < 64) {
@@ -31,82 +32,140 @@ CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
 
+  std::vector<uint32_t> addresses;
+  messages.reserve(dbc->num_msgs);
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
-    message_lookup[msg->address] = *msg;
+    MessagePack &m = messages.emplace_back();
+    m.msg = *msg;
+    m.first_signal = signals.size();
     for (int j = 0; j < msg->num_sigs; j++) {
       const Signal* sig = &msg->sigs[j];
-      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
+      const int handle = signals.size();
+      signals.push_back(*sig);
+      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = handle;
+      if (strcmp(sig->name, "COUNTER") == 0) m.counter = handle;
+      if (strcmp(sig->name, "CHECKSUM") == 0) {
+        m.checksum = handle;
+        m.checksum_func = get_checksum_func(sig->type);
+      }
     }
+    addresses.push_back(msg->address);
   }
+  message_index.build(addresses);
   init_crc_lookup_tables();
 }
 
-std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
-  std::vector<uint8_t> ret(message_lookup[address].size, 0);
+int CANPacker::signal_handle(uint32_t address, const std::string &name) const {
+  auto sig_it = signal_lookup.find(std::make_pair(address, name));
+  return sig_it == signal_lookup.end() ? -1 : sig_it->second;
+}
 
-  // set all values for all given signal/value pairs
-  for (const auto& sigval : signals) {
-    auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
-    if (sig_it == signal_lookup.end()) {
+std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signal_values, int counter) {
+  std::vector<SignalHandleValue> values;
+  values.reserve(signal_values.size());
+  for (const auto& sigval : signal_values) {
+    const int handle = signal_handle(address, sigval.name);
+    if (handle < 0) {
       // TODO: do something more here. invalid flag like CANParser?
       WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
       continue;
     }
-    const auto &sig = sig_it->second;
-
-    int64_t ival = (int64_t)(round((sigval.value - sig.offset) / sig.factor));
-    if (ival < 0) {
-      ival = (1ULL << sig.size) + ival;
-    }
+    values.push_back({handle, sigval.value});
+  }
+  return pack(address, values, counter);
+}
 
-    set_value(ret, sig, ival);
+static int64_t raw_value(const Signal &sig, double value) {
+  int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
+  if (ival < 0) {
+    ival = (1ULL << sig.size) + ival;
   }
+  return ival;
+}
 
+void CANPacker::set_counter_and_checksum(const MessagePack &m, kj::ArrayPtr<uint8_t> dat, int counter) const {
   // set message counter
   if (counter >= 0){
-    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
-    if (sig_it == signal_lookup.end()) {
+    if (m.counter < 0) {
       WARN("COUNTER not defined\n");
-      return ret;
+      return;
     }
-    const auto& sig = sig_it->second;
+    const auto& sig = signals[m.counter];
 
     if ((sig.type != SignalType::HONDA_COUNTER) && (sig.type != SignalType::VOLKSWAGEN_COUNTER)) {
       //WARN("COUNTER signal type not valid\n");
     }
 
-    set_value(ret, sig, counter);
+    set_value(dat, sig, counter);
   }
 
   // set message checksum
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto &sig = sig_it_checksum->second;
-    if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret);
-      set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret);
-      set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
-      unsigned int chksm = volkswagen_crc(address, ret);
-      set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret);
-      set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ret);
-      set_value(ret, sig, chksm);
-    } else {
-      //WARN("CHECKSUM signal type not valid\n");
+  if (m.checksum_func) {
+    set_value(dat, signals[m.checksum], m.checksum_func(m.msg.address, dat));
+  }
+}
+
+std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalHandleValue> &values, int counter) {
+  const int msg_idx = message_index.find(address);
+  if (msg_idx < 0) {
+    WARN("undefined message %d\n", address);
+    return {};
+  }
+  const MessagePack &m = messages[msg_idx];
+  std::vector<uint8_t> ret(m.msg.size, 0);
+  const kj::ArrayPtr<uint8_t> dat(ret.data(), ret.size());
+
+  // set all values for all given signal/value pairs
+  for (const auto& sigval : values) {
+    // a handle of another message, or another packer, would write the wrong signal or past signals
+    if (sigval.handle < m.first_signal || sigval.handle >= m.first_signal + (int)m.msg.num_sigs) {
+      WARN("invalid signal handle %d - %d\n", sigval.handle, address);
+      continue;
     }
+    const auto &sig = signals[sigval.handle];
+    set_value(dat, sig, raw_value(sig, sigval.value));
   }
 
+  set_counter_and_checksum(m, dat, counter);
   return ret;
 }
 
+PackPlan CANPacker::pack_plan(uint32_t address, const std::vector<std::string> &signal_names) const {
+  PackPlan plan = {.msg_idx = message_index.find(address), .address = address};
+  if (plan.msg_idx < 0) {
+    WARN("undefined message %d\n", address);
+    return plan;
+  }
+  plan.size = messages[plan.msg_idx].msg.size;
+  for (const auto &name : signal_names) {
+    const int handle = signal_handle(address, name);
+    if (handle < 0) {
+      WARN("undefined signal %s - %d\n", name.c_str(), address);
+    }
+    plan.handles.push_back(handle);
+  }
+  return plan;
+}
+
+bool CANPacker::pack(const PackPlan &plan, const double *values, int counter, uint8_t *out) const {
+  if (plan.msg_idx < 0) {
+    return false;
+  }
+  const kj::ArrayPtr<uint8_t> dat(out, plan.size);
+  memset(out, 0, plan.size);
+  for (int i = 0; i < plan.handles.size(); i++) {
+    if (plan.handles[i] < 0) continue;
+    const auto &sig = signals[plan.handles[i]];
+    set_value(dat, sig, raw_value(sig, values[i]));
+  }
+
+  set_counter_and_checksum(messages[plan.msg_idx], dat, counter);
+  return true;
+}
+
 // This function has a definition in common.h and is used in PlotJuggler
 Msg* CANPacker::lookup_message(uint32_t address) {
-  return &message_lookup[address];
+  const int msg_idx = message_index.find(address);
+  return msg_idx < 0 ? nullptr : &messages[msg_idx].msg;
 }
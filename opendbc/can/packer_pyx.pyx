@@ -9,7 +9,8 @@ from libcpp cimport bool
 from posix.dlfcn cimport dlopen, dlsym, RTLD_LAZY
 
 from .common cimport CANPacker as cpp_CANPacker
-from .common cimport dbc_lookup, SignalPackValue, DBC
+from .common cimport PackPlan as cpp_PackPlan
+from .common cimport dbc_lookup, SignalHandleValue, DBC
 
 
 cdef class CANPacker:
@@ -18,6 +19,7 @@ cdef class CANPacker:
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
     map[int, int] address_to_size
+    dict signal_handles
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -25,24 +27,38 @@ cdef class CANPacker:
       raise RuntimeError(f"Can't lookup {dbc_name}")
 
     self.packer = new cpp_CANPacker(dbc_name)
+    self.signal_handles = {}
     num_msgs = self.dbc[0].num_msgs
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
       self.address_to_size[msg.address] = msg.size
 
-  cdef vector[uint8_t] pack(self, addr, values, counter):
-    cdef vector[SignalPackValue] values_thing
+  cdef vector[uint8_t] pack(self, uint32_t addr, values, int counter):
+    cdef vector[SignalHandleValue] values_thing
     values_thing.reserve(len(values))
-    cdef SignalPackValue spv
+    cdef SignalHandleValue shv
 
     for name, value in values.iteritems():
-      spv.name = name.encode('utf8')
-      spv.value = value
-      values_thing.push_back(spv)
+      handle = self.signal_handles.get((addr, name))
+      if handle is None:
+        handle = self.packer.signal_handle(addr, name.encode('utf8'))
+        if handle < 0:
+          print(f"undefined signal {name} - {addr}")
+        self.signal_handles[(addr, name)] = handle
+      if handle < 0:
+        continue
+      shv.handle = handle
+      shv.value = value
+      values_thing.push_back(shv)
 
     return self.packer.pack(addr, values_thing, counter)
 
+  cdef int address(self, name_or_addr) except? -1:
+    if type(name_or_addr) == int:
+      return name_or_addr
+    return self.name_to_address_and_size[name_or_addr.encode('utf8')][0]
+
   cpdef make_can_msg(self, name_or_addr, bus, values, counter=-1):
     cdef int addr, size
     if type(name_or_addr) == int:
@@ -53,3 +69,32 @@ cdef class CANPacker:
 
     cdef vector[uint8_t] val = self.pack(addr, values, counter)
     return [addr, 0, (<char *>&val[0])[:size], bus]
+
+  def pack_plan(self, name_or_addr, signal_names):
+    """Resolves a message and its signals once. PackPlan.make_can_msg then takes the values
+    of signal_names in order, for messages sent every frame with the same signals."""
+    plan = PackPlan()
+    plan.packer = self
+    plan.signal_names = list(signal_names)
+    plan.plan = self.packer.pack_plan(self.address(name_or_addr), [n.encode('utf8') for n in plan.signal_names])
+    plan.values.resize(len(plan.signal_names))
+    return plan
+
+
+cdef class PackPlan:
+  cdef:
+    CANPacker packer
+    cpp_PackPlan plan
+    vector[double] values
+    readonly list signal_names
+
+  cpdef make_can_msg(self, bus, values, counter=-1):
+    cdef uint8_t dat[64]
+    if len(values) != self.values.size():
+      raise ValueError(f"expected {self.values.size()} values, got {len(values)}")
+    for i, v in enumerate(values):
+      self.values[i] = v
+
+    if not self.packer.packer.pack_with_plan(self.plan, self.values.data(), counter, dat):
+      raise RuntimeError(f"undefined message {self.plan.address}")
+    return [self.plan.address, 0, (<char *>dat)[:self.plan.size], bus]
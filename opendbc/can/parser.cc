@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
 #include <unistd.h>
@@ -10,7 +11,7 @@
 #include "common.h"
 
 
-int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
+int64_t get_raw_value(kj::ArrayPtr<const uint8_t> msg, const Signal &sig) {
   int64_t ret = 0;
 
   int i = sig.msb / 8;
@@ -21,7 +22,7 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
     int size = msb - lsb + 1;
 
     uint8_t d = (msg[i] >> (lsb - (i*8))) & ((1ULL << size) - 1);
-    ret |= d << (bits - size);
+    ret |= (uint64_t)d << (bits - size);
 
     bits -= size;
     i = sig.is_little_endian ? i-1 : i+1;
@@ -30,49 +31,65 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
 }
 
 
-bool MessageState::parse(uint64_t sec, const std::vector<uint8_t> &dat) {
-
+void MessageState::init_checks() {
+  checksum_idx = counter_idx = -1;
+  checksum = nullptr;
   for (int i = 0; i < parse_sigs.size(); i++) {
-    auto &sig = parse_sigs[i];
+    const SignalType type = parse_sigs[i].type;
+    if (ChecksumFunc f = get_checksum_func(type); f && checksum_idx < 0) {
+      checksum_idx = i;
+      checksum = f;
+    } else if ((type == SignalType::HONDA_COUNTER || type == SignalType::VOLKSWAGEN_COUNTER ||
+                type == SignalType::PEDAL_COUNTER) && counter_idx < 0) {
+      counter_idx = i;
+    }
+  }
+}
 
+bool MessageState::parse(uint64_t sec, kj::ArrayPtr<const uint8_t> dat) {
+  // short messages go through get_raw_value, which only reads the bytes that are there
+  const bool generated = decode && dat.size() >= size;
+  if (generated) {
+    uint8_t buf[64 + MSG_DECODE_PADDING];
+    memcpy(buf, dat.begin(), dat.size());
+    memset(buf + dat.size(), 0, MSG_DECODE_PADDING);
+    decode(buf, raw_vals.data());
+  }
+
+  auto raw_value = [&](int i) -> int64_t {
+    const auto &sig = parse_sigs[i];
+    if (generated) {
+      return raw_vals[sig_index[i]];
+    }
     int64_t tmp = get_raw_value(dat, sig);
     if (sig.is_signed) {
       tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
     }
+    return tmp;
+  };
+
+  // checks run once per frame, before any value is updated. a frame shorter than the message
+  // can't hold its checksum, so it fails without computing one
+  bool checksum_failed = false;
+  if (!ignore_checksum && checksum_idx >= 0) {
+    checksum_failed = dat.size() < size || checksum(address, dat) != raw_value(checksum_idx);
+  }
 
-    DEBUG("parse 0x%X %s -> %ld\n", address, sig.name, tmp);
-
-    bool checksum_failed = false;
-    if (!ignore_checksum) {
-      if (sig.type == SignalType::HONDA_CHECKSUM && honda_checksum(address, dat) != tmp) {
-        checksum_failed = true;
-      } else if (sig.type == SignalType::TOYOTA_CHECKSUM && toyota_checksum(address, dat) != tmp) {
-        checksum_failed = true;
-      } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM && volkswagen_crc(address, dat) != tmp) {
-        checksum_failed = true;
-      } else if (sig.type == SignalType::SUBARU_CHECKSUM && subaru_checksum(address, dat) != tmp) {
-        checksum_failed = true;
-      } else if (sig.type == SignalType::CHRYSLER_CHECKSUM && chrysler_checksum(address, dat) != tmp) {
-        checksum_failed = true;
-      } else if (sig.type == SignalType::PEDAL_CHECKSUM && pedal_checksum(dat) != tmp) {
-        checksum_failed = true;
-      }
-    }
+  bool counter_failed = false;
+  if (!ignore_counter && counter_idx >= 0 && !checksum_failed) {
+    counter_failed = !update_counter_generic(raw_value(counter_idx), parse_sigs[counter_idx].size);
+  }
 
-    bool counter_failed = false;
-    if (!ignore_counter) {
-      if (sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::VOLKSWAGEN_COUNTER || sig.type == SignalType::PEDAL_COUNTER) { 
-        counter_failed = !update_counter_generic(tmp, sig.size);
-      }
-    }
+  if (checksum_failed || counter_failed) {
+    WARN("0x%X message checks failed, checksum failed %d, counter failed %d\n", address, checksum_failed, counter_failed);
+    return false;
+  }
 
-    if (checksum_failed || counter_failed) {
-      WARN("0x%X message checks failed, checksum failed %d, counter failed %d\n", address, checksum_failed, counter_failed);
-      return false;
-    }
+  for (int i = 0; i < parse_sigs.size(); i++) {
+    const int64_t tmp = raw_value(i);
+    DEBUG("parse 0x%X %s -> %ld\n", address, parse_sigs[i].name, tmp);
 
-    // TODO: these may get updated if the invalid or checksum gets checked later
-    vals[i] = tmp * sig.factor + sig.offset;
+    vals[i] = tmp * parse_sigs[i].factor + parse_sigs[i].offset;
     all_vals[i].push_back(vals[i]);
   }
   seen = sec;
@@ -108,8 +125,18 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
   assert(dbc);
   init_crc_lookup_tables();
 
+  std::vector<uint32_t> addresses;
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
+    auto addr_it = std::find(addresses.begin(), addresses.end(), op.address);
+    if (addr_it == addresses.end()) {
+      addresses.push_back(op.address);
+      message_states.emplace_back();
+      addr_it = addresses.end() - 1;
+    } else {
+      // a repeated address replaces the earlier entry instead of tracking its signals twice
+      message_states[addr_it - addresses.begin()] = MessageState();
+    }
+    MessageState &state = message_states[addr_it - addresses.begin()];
     state.address = op.address;
     // state.check_frequency = op.check_frequency,
 
@@ -132,14 +159,17 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
     state.size = msg->size;
     assert(state.size < 64);  // max signal size is 64 bytes
+    state.decode = msg->decode;
+    state.raw_vals.resize(msg->num_sigs);
 
     // track checksums and counters for this message
     for (int i = 0; i < msg->num_sigs; i++) {
       const Signal *sig = &msg->sigs[i];
       if (sig->type != SignalType::DEFAULT) {
         state.parse_sigs.push_back(*sig);
+        state.sig_index.push_back(i);
         state.vals.push_back(0);
-        state.all_vals.push_back({});
+        state.all_vals.emplace_back().reserve(ALL_VALS_RESERVE);
       }
     }
 
@@ -152,13 +182,16 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
         if (strcmp(sig->name, sigop.name) == 0
             && sig->type == SignalType::DEFAULT) {
           state.parse_sigs.push_back(*sig);
+          state.sig_index.push_back(i);
           state.vals.push_back(0);
-          state.all_vals.push_back({});
+          state.all_vals.emplace_back().reserve(ALL_VALS_RESERVE);
           break;
         }
       }
     }
   }
+  message_index.build(addresses);
+  init_signal_buffers();
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -169,6 +202,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
   assert(dbc);
   init_crc_lookup_tables();
 
+  std::vector<uint32_t> addresses;
+  message_states.reserve(dbc->num_msgs);
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     MessageState state = {
@@ -176,17 +211,23 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
       .size = msg->size,
       .ignore_checksum = ignore_checksum,
       .ignore_counter = ignore_counter,
+      .decode = msg->decode,
     };
+    state.raw_vals.resize(msg->num_sigs);
 
     for (int j = 0; j < msg->num_sigs; j++) {
       const Signal *sig = &msg->sigs[j];
       state.parse_sigs.push_back(*sig);
+      state.sig_index.push_back(j);
       state.vals.push_back(0);
-      state.all_vals.push_back({});
+      state.all_vals.emplace_back().reserve(ALL_VALS_RESERVE);
     }
 
-    message_states[state.address] = state;
+    addresses.push_back(state.address);
+    message_states.push_back(std::move(state));
   }
+  message_index.build(addresses);
+  init_signal_buffers();
 }
 
 #ifndef DYNAMIC_CAPNP
@@ -220,28 +261,47 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
       continue;
     }
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
-      // DEBUG("skip %d: not specified\n", cmsg.getAddress());
-      continue;
+    UpdateFrame(sec, cmsg.getAddress(), cmsg.getDat());
+  }
+}
+
+CANDispatcher::CANDispatcher(const std::vector<CANParser *> &parsers)
+  : aligned_buf(kj::heapArray<capnp::word>(1024)), parsers(parsers) {
+  for (CANParser *p : parsers) {
+    if (p->bus >= bus_parsers.size()) {
+      bus_parsers.resize(p->bus + 1);
     }
+    bus_parsers[p->bus].push_back(p);
+  }
+}
 
-    auto dat = cmsg.getDat();
+void CANDispatcher::update_string(const std::string &data, bool sendcan) {
+  // format for board, make copy due to alignment issues.
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
 
-    if (dat.size() > 64) {
-      DEBUG("got message longer than 64 bytes: 0x%X %zu\n", cmsg.getAddress(), dat.size());
-      continue;
-    }
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+  const uint64_t sec = event.getLogMonoTime();
 
-    // TODO: this actually triggers for some cars. fix and enable this
-    //if (dat.size() != state_it->second.size) {
-    //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state_it->second.size, dat.size(), cmsg.getAddress());
-    //  continue;
-    //}
+  auto cans = sendcan ? event.getSendcan() : event.getCan();
+  for (const auto frame : cans) {
+    const uint8_t src = frame.getSrc();
+    if (src >= bus_parsers.size()) continue;
+
+    const uint32_t address = frame.getAddress();
+    const auto dat = frame.getDat();
+    for (CANParser *p : bus_parsers[src]) {
+      p->UpdateFrame(sec, address, dat);
+    }
+  }
 
-    std::vector<uint8_t> data(dat.size(), 0);
-    memcpy(data.data(), dat.begin(), dat.size());
-    state_it->second.parse(sec, data);
+  for (CANParser *p : parsers) {
+    p->last_sec = sec;
+    p->UpdateValid(sec);
   }
 }
 #endif
@@ -255,23 +315,66 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
-    DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
-    return;
+  UpdateFrame(sec, cmsg.get("address").as<uint32_t>(), cmsg.get("dat").as<capnp::Data>());
+}
+
+MessageState *CANParser::UpdateFrame(uint64_t sec, uint32_t address, kj::ArrayPtr<const uint8_t> dat) {
+  const int state_idx = message_index.find(address);
+  if (state_idx < 0) {
+    // DEBUG("skip %d: not specified\n", address);
+    return nullptr;
+  }
+
+  if (dat.size() > 64) {
+    DEBUG("got message longer than 64 bytes: 0x%X %zu\n", address, dat.size());
+    return nullptr;
+  }
+
+  // TODO: this actually triggers for some cars. fix and enable this
+  //if (dat.size() != message_states[state_idx].size) {
+  //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", message_states[state_idx].size, dat.size(), address);
+  //  return nullptr;
+  //}
+
+  MessageState &state = message_states[state_idx];
+  if (!state.parse(sec, dat)) return nullptr;
+
+  for (int i = 0; i < state.vals.size(); i++) {
+    const int id = state.first_signal_id + i;
+    if (signal_values[id] != state.vals[i] && !signal_changed[id]) {
+      signal_changed[id] = true;
+      changed_ids[num_changed++] = id;
+    }
+    signal_values[id] = state.vals[i];
+    signal_times[id] = sec;
+  }
+  return &state;
+}
+
+void CANParser::set_checks(bool checksum, bool counter) {
+  for (auto &state : message_states) {
+    state.ignore_checksum = !checksum;
+    state.ignore_counter = !counter;
   }
+}
 
-  auto dat = cmsg.get("dat").as<capnp::Data>();
-  if (dat.size() > 64) return; // shouldn't ever happen
-  std::vector<uint8_t> data(dat.size(), 0);
-  memcpy(data.data(), dat.begin(), dat.size());
-  state_it->second.parse(sec, data);
+void CANParser::init_signal_buffers() {
+  int num_signals = 0;
+  for (auto &state : message_states) {
+    state.first_signal_id = num_signals;
+    num_signals += state.parse_sigs.size();
+    state.init_checks();
+  }
+  // NAN so that the first value of every signal counts as changed
+  signal_values.assign(num_signals, NAN);
+  signal_times.assign(num_signals, 0);
+  signal_changed.assign(num_signals, false);
+  changed_ids.assign(num_signals, -1);
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
   can_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (state.check_threshold > 0 && (sec - state.seen) > state.check_threshold && sec > 105000000000) {
       // opkr
       char chk_cmd[100];
@@ -293,24 +396,45 @@ void CANParser::UpdateValid(uint64_t sec) {
   }
 }
 
-std::vector<SignalValue> CANParser::query_latest() {
-  std::vector<SignalValue> ret;
-
-  for (auto& kv : message_states) {
-    auto& state = kv.second;
+size_t CANParser::query_latest(std::vector<SignalValue> &vals) {
+  size_t n = 0;
+  for (auto& state : message_states) {
     if (last_sec != 0 && state.seen != last_sec) continue;
 
     for (int i = 0; i < state.parse_sigs.size(); i++) {
-      const Signal &sig = state.parse_sigs[i];
-      ret.push_back((SignalValue){
-        .address = state.address,
-        .name = sig.name,
-        .value = state.vals[i],
-        .all_values = state.all_vals[i],
-      });
+      if (n == vals.size()) vals.emplace_back();
+      SignalValue &v = vals[n++];
+      v.address = state.address;
+      v.name = state.parse_sigs[i].name;
+      v.value = state.vals[i];
+      v.all_values.assign(state.all_vals[i].begin(), state.all_vals[i].end());
       state.all_vals[i].clear();
     }
   }
+  return n;
+}
 
+std::vector<SignalParseOptions> CANParser::signal_ids() const {
+  std::vector<SignalParseOptions> ret;
+  for (const auto& state : message_states) {
+    for (const auto& sig : state.parse_sigs) {
+      ret.push_back({.address = state.address, .name = sig.name});
+    }
+  }
   return ret;
 }
+
+size_t CANParser::query_changed() {
+  const size_t n = num_changed;
+  for (int i = 0; i < n; i++) {
+    signal_changed[changed_ids[i]] = false;
+  }
+  num_changed = 0;
+
+  // parse keeps every value of the cycle for query_latest, drop them here so they don't pile up.
+  // clear keeps the capacity, so this doesn't allocate either
+  for (auto &state : message_states) {
+    for (auto &v : state.all_vals) v.clear();
+  }
+  return n;
+}
@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "common.h"
+#include "selfdrive/common/benchmark.h"
+
+// parse random frames of every message in every DBC through MessageState::parse,
+// once with the generated decoders and once with the get_raw_value interpreter.
+// then run the same frames through CANParser::update_string and query_latest, as parser_pyx does
+// every cycle, and count the heap allocations once all_vals and the query buffer are warmed up,
+// which must be zero. the update_changed path, update_string and query_changed, must not allocate
+// or grow the heap either, however many cycles it runs.
+// usage: parser_benchmark [iterations]
+
+const int FRAMES_PER_MSG = 16;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double run(std::vector<MessageState> &states, const std::vector<std::vector<std::vector<uint8_t>>> &frames, int iterations) {
+  auto start = std::chrono::steady_clock::now();
+  for (int it = 0; it < iterations; it++) {
+    for (int i = 0; i < states.size(); i++) {
+      for (const auto &dat : frames[i]) {
+        states[i].parse(it, kj::arrayPtr(dat.data(), dat.size()));
+      }
+      for (auto &v : states[i].all_vals) v.clear();
+    }
+  }
+  return seconds_since(start);
+}
+
+// one can event per frame index, holding that frame of every message on bus 0
+static std::vector<std::string> build_events(const DBC *dbc, const std::vector<std::vector<std::vector<uint8_t>>> &frames) {
+  std::vector<std::string> events;
+  for (int f = 0; f < FRAMES_PER_MSG; f++) {
+    capnp::MallocMessageBuilder msg(1 << 16);  // a single segment, as from boardd
+    auto event = msg.initRoot<cereal::Event>();
+    event.setLogMonoTime(f + 1);
+    auto can = event.initCan(dbc->num_msgs);
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      can[i].setAddress(dbc->msgs[i].address);
+      can[i].setSrc(0);
+      can[i].setDat(kj::arrayPtr(frames[i][f].data(), frames[i][f].size()));
+    }
+    auto words = capnp::messageToFlatArray(msg);
+    auto bytes = words.asBytes();
+    events.emplace_back(bytes.begin(), bytes.end());
+  }
+  return events;
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  std::mt19937 gen(0);
+
+  printf("%-50s %6s %14s %14s %8s %14s %8s %8s %10s\n", "dbc", "msgs", "interp (msg/s)", "gen (msg/s)", "speedup",
+         "update (msg/s)", "allocs", "changed", "heap (B)");
+  uint64_t mismatches = 0, total_allocs = 0, heap_growth = 0;
+  double total_interp = 0, total_gen = 0;
+  size_t total_frames = 0;
+  for (const DBC *dbc : get_dbcs()) {
+    std::vector<MessageState> generated, interpreted;
+    std::vector<std::vector<std::vector<uint8_t>>> frames;
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      MessageState state = {
+        .address = msg.address,
+        .size = msg.size,
+        .ignore_checksum = true,
+        .ignore_counter = true,
+        .decode = msg.decode,
+      };
+      state.raw_vals.resize(msg.num_sigs);
+      for (int j = 0; j < msg.num_sigs; j++) {
+        state.parse_sigs.push_back(msg.sigs[j]);
+        state.sig_index.push_back(j);
+        state.vals.push_back(0);
+        state.all_vals.push_back({});
+      }
+      state.init_checks();
+      generated.push_back(state);
+      state.decode = nullptr;
+      interpreted.push_back(state);
+
+      frames.emplace_back();
+      for (int f = 0; f < FRAMES_PER_MSG; f++) {
+        std::vector<uint8_t> dat(msg.size);
+        for (auto &b : dat) b = gen();
+        frames.back().push_back(dat);
+      }
+    }
+
+    // both paths must agree on every signal
+    for (int i = 0; i < generated.size(); i++) {
+      for (const auto &dat : frames[i]) {
+        generated[i].parse(0, kj::arrayPtr(dat.data(), dat.size()));
+        interpreted[i].parse(0, kj::arrayPtr(dat.data(), dat.size()));
+        for (int j = 0; j < generated[i].vals.size(); j++) {
+          if (generated[i].vals[j] != interpreted[i].vals[j]) {
+            printf("mismatch %s 0x%X %s: %f != %f\n", dbc->name, generated[i].address, generated[i].parse_sigs[j].name,
+                   generated[i].vals[j], interpreted[i].vals[j]);
+            mismatches++;
+          }
+        }
+      }
+    }
+
+    const size_t n = dbc->num_msgs * FRAMES_PER_MSG * (size_t)iterations;
+    const double t_interp = run(interpreted, frames, iterations);
+    const double t_gen = run(generated, frames, iterations);
+
+    // full update_string path, with query_latest between updates as in parser_pyx
+    CANParser parser(0, dbc->name, true, true);
+    const std::vector<std::string> events = build_events(dbc, frames);
+    std::vector<SignalValue> latest;
+    uint64_t allocs = 0;
+    double t_update = 0;
+    for (int it = 0; it < iterations + 1; it++) {
+      const uint64_t start_allocs = benchmark::allocations();
+      auto start = std::chrono::steady_clock::now();
+      for (const auto &e : events) {
+        parser.update_string(e, false);
+      }
+      const double t = seconds_since(start);
+      parser.query_latest(latest);
+      // the first iteration grows aligned_buf, all_vals and latest
+      if (it > 0) {
+        t_update += t;
+        allocs += benchmark::allocations() - start_allocs;
+      }
+    }
+
+    // update_changed path, nothing queries all_vals
+    CANParser changed_parser(0, dbc->name, true, true);
+    for (const auto &e : events) changed_parser.update_string(e, false);
+    changed_parser.query_changed();
+    const uint64_t changed_start_allocs = benchmark::allocations();
+    const int64_t changed_start_heap = benchmark::heap_in_use();
+    for (int it = 0; it < iterations; it++) {
+      for (const auto &e : events) {
+        changed_parser.update_string(e, false);
+      }
+      changed_parser.query_changed();
+    }
+    const uint64_t changed_allocs = benchmark::allocations() - changed_start_allocs;
+    const int64_t changed_heap = benchmark::heap_in_use() - changed_start_heap;
+
+    printf("%-50s %6zu %14.0f %14.0f %7.2fx %14.0f %8lu %8lu %10ld\n", dbc->name, dbc->num_msgs, n / t_interp, n / t_gen,
+           t_interp / t_gen, n / t_update, allocs, changed_allocs, changed_heap);
+    total_interp += t_interp;
+    total_gen += t_gen;
+    total_frames += n;
+    total_allocs += allocs + changed_allocs;
+    heap_growth += changed_heap != 0;
+  }
+  printf("%-50s %6s %14.0f %14.0f %7.2fx %14s %8lu\n", "total", "", total_frames / total_interp,
+         total_frames / total_gen, total_interp / total_gen, "", total_allocs);
+  return mismatches > 0 || total_allocs > 0 || heap_growth > 0;
+}
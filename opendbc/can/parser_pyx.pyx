@@ -9,10 +9,13 @@ from libcpp cimport bool
 from libcpp.map cimport map
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport CANDispatcher as cpp_CANDispatcher
+from .common cimport decode_logs as cpp_decode_logs
+from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, SignalSeries, DBC, LogData
 
 import os
 import numbers
+import numpy as np
 from collections import defaultdict
 
 cdef int CAN_INVALID_CNT = 5
@@ -25,6 +28,9 @@ cdef class CANParser:
     map[string, uint32_t] msg_name_to_address
     map[uint32_t, string] address_to_msg_name
     vector[SignalValue] can_values
+    list signal_keys
+    double[::1] values_view
+    uint64_t[::1] times_view
 
   cdef readonly:
     dict vl
@@ -103,17 +109,45 @@ cdef class CANParser:
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
     self.update_vl()
 
-  cdef unordered_set[uint32_t] update_vl(self):
-    cdef unordered_set[uint32_t] updated_addrs
+    # signal id -> (address, name), and views on the parser's value buffers without copies
+    cdef vector[SignalParseOptions] ids = self.can.signal_ids()
+    self.signal_keys = [(ids[i].address, <unicode>ids[i].name) for i in range(ids.size())]
+    cdef size_t num_signals = self.can.signal_values.size()
+    if num_signals > 0:
+      self.values_view = <double[:num_signals]> self.can.signal_values.data()
+      self.times_view = <uint64_t[:num_signals]> self.can.signal_times.data()
 
-    # Update invalid flag
+  @property
+  def signal_values(self):
+    return self.values_view
+
+  @property
+  def signal_times(self):
+    return self.times_view
+
+  def signal_id(self, address, name):
+    if not isinstance(address, numbers.Number):
+      address = self.msg_name_to_address[address.encode('utf8')]
+    return self.signal_keys.index((address, name))
+
+  cdef void update_valid(self):
     self.can_invalid_cnt += 1
     if self.can.can_valid:
       self.can_invalid_cnt = 0
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
 
-    new_vals = self.can.query_latest()
-    for cv in new_vals:
+  cdef unordered_set[uint32_t] update_vl(self):
+    cdef unordered_set[uint32_t] updated_addrs
+    cdef size_t i, n
+    cdef SignalValue *cv
+
+    # Update invalid flag
+    self.update_valid()
+
+    # can_values is reused from call to call
+    n = self.can.query_latest(self.can_values)
+    for i in range(n):
+      cv = &self.can_values[i]
       # Cast char * directly to unicode
       cv_name = <unicode>cv.name
       self.vl[cv.address][cv_name] = cv.value
@@ -139,6 +173,106 @@ cdef class CANParser:
       updated_addrs.update(self.update_vl())
     return updated_addrs
 
+  def update_changed(self, strings, sendcan=False):
+    # like update_strings, but only writes the signals whose value changed into vl.
+    # vl_all is not filled, the latest values are also in signal_values by signal id.
+    # don't mix with update_string(s) on the same parser, this drops the values kept for vl_all.
+    for s in strings:
+      self.can.update_string(s, sendcan)
+      self.update_valid()
+
+    cdef size_t i
+    cdef size_t n = self.can.query_changed()
+    updated_addrs = set()
+    for i in range(n):
+      sig_id = self.can.changed_ids[i]
+      address, name = self.signal_keys[sig_id]
+      self.vl[address][name] = self.values_view[sig_id]
+      updated_addrs.add(address)
+    return updated_addrs
+
+
+cdef class CANDispatcher:
+  cdef:
+    cpp_CANDispatcher *dispatcher
+    list parsers
+
+  def __init__(self, parsers):
+    self.parsers = list(parsers)
+
+    cdef vector[cpp_CANParser *] parsers_v
+    cdef CANParser p
+    for p in self.parsers:
+      parsers_v.push_back(p.can)
+    self.dispatcher = new cpp_CANDispatcher(parsers_v)
+
+  def __dealloc__(self):
+    del self.dispatcher
+
+  def update_strings(self, strings, sendcan=False):
+    # same as calling update_strings on every parser, but each string is only decoded once
+    cdef CANParser p
+    for p in self.parsers:
+      for v in p.vl_all.values():
+        v.clear()
+
+    updated_addrs = [set() for _ in self.parsers]
+    for s in strings:
+      self.dispatcher.update_string(s, sendcan)
+      for i, p in enumerate(self.parsers):
+        updated_addrs[i].update(p.update_vl())
+    return updated_addrs
+
+
+def decode_logs(dbc_name, signals, logs, bus=0, sendcan=False, threads=0, checks=True):
+  # decodes every value of the signals in whole logs at once, one thread per log.
+  # signals are (signal name, address or message name) as for CANParser, logs are raw (decompressed) rlogs
+  # as bytes, which are read in place. with checks, frames that fail their checksum or counter check are
+  # left out, as CANParser does. returns {(address, signal name): (times, values)} with numpy arrays, in log order
+  cdef size_t i, n
+  cdef bytes log
+  cdef LogData log_data
+  cdef const DBC *dbc = dbc_lookup(dbc_name)
+  if not dbc:
+    raise RuntimeError(f"Can't find DBC: {dbc_name}")
+  msg_name_to_address = {}
+  for i in range(dbc[0].num_msgs):
+    msg_name_to_address[dbc[0].msgs[i].name.decode('utf8')] = dbc[0].msgs[i].address
+
+  signals = [(name, address if isinstance(address, numbers.Number) else msg_name_to_address[address])
+             for name, address in signals]
+  cdef vector[SignalParseOptions] signal_options_v
+  cdef SignalParseOptions spo
+  for sig_name, sig_address in signals:
+    spo.address = sig_address
+    spo.name = sig_name
+    signal_options_v.push_back(spo)
+
+  # views of the logs, which stay alive in logs for the call
+  cdef vector[LogData] logs_v
+  for log in logs:
+    log_data.data = log
+    log_data.size = len(log)
+    logs_v.push_back(log_data)
+
+  cdef string dbc_name_s = dbc_name
+  cdef int bus_i = bus, threads_i = threads
+  cdef bool sendcan_b = sendcan, checks_b = checks
+  cdef vector[SignalSeries] series
+  with nogil:
+    series = cpp_decode_logs(bus_i, dbc_name_s, signal_options_v, logs_v, sendcan_b, checks_b, threads_i)
+
+  ret = {}
+  for i in range(series.size()):
+    n = series[i].times.size()
+    times = np.empty(n, dtype=np.uint64)
+    values = np.empty(n, dtype=np.float64)
+    if n > 0:
+      times[:] = <uint64_t[:n]> series[i].times.data()
+      values[:] = <double[:n]> series[i].values.data()
+    ret[(series[i].address, <unicode>series[i].name)] = (times, values)
+  return ret
+
 
 cdef class CANDefine():
   cdef:
@@ -7,6 +7,26 @@ import jinja2
 from collections import Counter
 from opendbc.can.dbc import dbc
 
+def decode_expr(sig):
+  # C++ expression for the raw value of sig using fixed shifts and masks on a 64-bit load,
+  # equivalent to get_raw_value in parser.cc
+  mask = "0x%XULL" % ((1 << sig.size) - 1)
+  lo_byte, hi_byte = sorted((sig.msb // 8, sig.lsb // 8))
+  if sig.is_little_endian:
+    shift = sig.lsb - lo_byte * 8
+    expr = "load_le64(dat + %d) >> %d" % (lo_byte, shift)
+    if hi_byte - lo_byte >= 8:
+      expr = "(%s) | ((uint64_t)dat[%d] << %d)" % (expr, hi_byte, 64 - shift)
+  elif hi_byte - lo_byte < 8:
+    expr = "load_be64(dat + %d) >> %d" % (lo_byte, (7 - (hi_byte - lo_byte)) * 8 + sig.lsb % 8)
+  else:
+    shift = sig.lsb % 8
+    expr = "(load_be64(dat + %d) << %d) | (dat[%d] >> %d)" % (lo_byte, 8 - shift, hi_byte, shift)
+  expr = "(%s) & %s" % (expr, mask)
+  if sig.is_signed and sig.size < 64:
+    expr = "(int64_t)((%s) << %d) >> %d" % (expr, 64 - sig.size, 64 - sig.size)
+  return expr
+
 def process(in_fn, out_fn):
   dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
   # print("processing %s: %s -> %s" % (dbc_name, in_fn, out_fn))
@@ -103,7 +123,40 @@ def process(in_fn, out_fn):
     if count > 1:
       sys.exit("%s: Duplicate message name in DBC file %s" % (dbc_name, name))
 
-  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals)
+  # index of the first signal of each message in the flat signal table
+  first_sig, num_sigs = {}, 0
+  for address, _, _, sigs in msgs:
+    first_sig[address] = num_sigs
+    num_sigs += len(sigs)
+
+  # string table, names are stored as offsets into it
+  strings, strings_size = {}, 0
+  def string_offset(s):
+    nonlocal strings_size
+    if s not in strings:
+      strings[s] = strings_size
+      strings_size += len(s.encode()) + 1
+    return strings[s]
+
+  def raw_def_val(def_val):
+    # def_vals are C string literals, see dbc.py
+    return def_val[1:-1].replace(r"\?", "?")
+
+  for address, msg_name, _, sigs in msgs:
+    string_offset(msg_name)
+    for sig in sigs:
+      string_offset(sig.name)
+  for address, sig in def_vals:
+    for sg_name, def_val in sig:
+      string_offset(sg_name)
+      string_offset(raw_def_val(def_val))
+
+  def c_escape(s):
+    return s.replace("\\", "\\\\").replace('"', '\\"').replace("?", "\\?")
+
+  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals,
+                                decode_expr=decode_expr, first_sig=first_sig, string_offset=string_offset,
+                                raw_def_val=raw_def_val, strings=[c_escape(x) for x in strings])
 
   with open(out_fn, "a+") as out_f:
     out_f.seek(0)
@@ -112,6 +165,23 @@ def process(in_fn, out_fn):
       out_f.truncate()
       out_f.write(parser_code)
 
+def process_registry(in_fns, out_fn):
+  # name sorted list of every generated DBC, for dbc_lookup
+  template_fn = os.path.join(os.path.dirname(__file__), "dbc_registry_template.cc")
+
+  with open(template_fn, "r") as template_f:
+    template = jinja2.Template(template_f.read(), trim_blocks=True, lstrip_blocks=True)
+
+  names = sorted(os.path.split(fn)[-1].replace('.dbc', '') for fn in in_fns)
+  registry_code = template.render(names=names)
+
+  with open(out_fn, "a+") as out_f:
+    out_f.seek(0)
+    if out_f.read() != registry_code:
+      out_f.seek(0)
+      out_f.truncate()
+      out_f.write(registry_code)
+
 def main():
   if len(sys.argv) != 3:
     print("usage: %s dbc_directory output_filename" % (sys.argv[0],))
@@ -6,7 +6,8 @@ using namespace Eigen;
 
 EKFSym::EKFSym(std::string name, Map<MatrixXdr> Q, Map<VectorXd> x_initial, Map<MatrixXdr> P_initial, int dim_main,
     int dim_main_err, int N, int dim_augment, int dim_augment_err, std::vector<int> maha_test_kinds,
-    std::vector<int> quaternion_idxs, std::vector<std::string> global_vars, double max_rewind_age)
+    std::vector<int> quaternion_idxs, std::vector<std::string> global_vars, double max_rewind_age, int rewind_to_keep)
+  : rewind_history(rewind_to_keep), rewound(rewind_to_keep)
 {
   // TODO: add logger
 
@@ -86,13 +87,14 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
 {
   // TODO handle rewinding at this level
 
-  std::deque<Observation> rewound;
+  this->rewound.clear();
   if (!std::isnan(this->filter_time) && t < this->filter_time) {
-    if (this->rewind_t.empty() || t < this->rewind_t.front() || t < this->rewind_t.back() - this->max_rewind_age) {
-      LOGD("observation too old at %d with filter at %d, ignoring!", t, this->filter_time);
+    if (this->rewind_history.empty() || t < this->rewind_history.front().t ||
+        t < this->rewind_history.back().t - this->max_rewind_age) {
+      LOGD("observation too old at %f with filter at %f, ignoring!", t, this->filter_time);
       return std::nullopt;
     }
-    rewound = this->rewind(t);
+    this->rewind(t);
   }
 
   Observation obs;
@@ -109,51 +111,49 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
   std::optional<Estimate> res = std::make_optional(this->predict_and_update_batch(obs, augment));
 
   // optional fast forward
-  while (!rewound.empty()) {
-    this->predict_and_update_batch(rewound.front(), false);
-    rewound.pop_front();
+  for (size_t i = 0; i < this->rewound.size(); i++) {
+    this->predict_and_update_batch(this->rewound[i], false);
   }
 
   return res;
 }
 
 void EKFSym::reset_rewind() {
-  this->rewind_obscache.clear();
-  this->rewind_t.clear();
-  this->rewind_states.clear();
+  this->rewind_history.clear();
+  this->rewound.clear();
 }
 
-std::deque<Observation> EKFSym::rewind(double t) {
-  std::deque<Observation> rewound;
-
+void EKFSym::rewind(double t) {
   // rewind observations until t is after previous observation
-  while (this->rewind_t.back() > t) {
-    rewound.push_front(this->rewind_obscache.back());
-    this->rewind_t.pop_back();
-    this->rewind_states.pop_back();
-    this->rewind_obscache.pop_back();
+  size_t keep = this->rewind_history.size();
+  while (this->rewind_history[keep - 1].t > t) {
+    keep--;
+  }
+  for (size_t i = keep; i < this->rewind_history.size(); i++) {
+    this->rewound.push_back(this->rewind_history[i].obs);
+  }
+  while (this->rewind_history.size() > keep) {
+    this->rewind_history.pop_back();
   }
 
   // set the state to the time right before that
-  this->filter_time = this->rewind_t.back();
-  this->x = this->rewind_states.back().first;
-  this->P = this->rewind_states.back().second;
-
-  return rewound;
+  const Checkpoint &last = this->rewind_history.back();
+  this->filter_time = last.t;
+  this->x = last.x;
+  this->P = last.P;
 }
 
 void EKFSym::checkpoint(Observation& obs) {
-  // push to rewinder
-  this->rewind_t.push_back(this->filter_time);
-  this->rewind_states.push_back(std::make_pair(this->x, this->P));
-  this->rewind_obscache.push_back(obs);
-
-  // only keep a certain number around
-  if (this->rewind_t.size() > REWIND_TO_KEEP) {
-    this->rewind_t.pop_front();
-    this->rewind_states.pop_front();
-    this->rewind_obscache.pop_front();
+  if (this->rewind_history.capacity() == 0) {
+    return;
   }
+
+  // push to rewinder, once full this overwrites the oldest and reuses its memory
+  Checkpoint &c = this->rewind_history.push_back();
+  c.t = this->filter_time;
+  c.x = this->x;
+  c.P = this->P;
+  c.obs = obs;
 }
 
 Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
@@ -13,6 +13,7 @@
 #include <eigen3/Eigen/Dense>
 
 #include "common_ekf.h"
+#include "ring_buffer.h"
 
 #define REWIND_TO_KEEP 512
 
@@ -46,7 +47,8 @@ public:
       Eigen::Map<MatrixXdr> P_initial, int dim_main, int dim_main_err, int N = 0, int dim_augment = 0,
       int dim_augment_err = 0, std::vector<int> maha_test_kinds = std::vector<int>(),
       std::vector<int> quaternion_idxs = std::vector<int>(),
-      std::vector<std::string> global_vars = std::vector<std::string>(), double max_rewind_age = 1.0);
+      std::vector<std::string> global_vars = std::vector<std::string>(), double max_rewind_age = 1.0,
+      int rewind_to_keep = REWIND_TO_KEEP);
   void init_state(Eigen::Map<Eigen::VectorXd> state, Eigen::Map<MatrixXdr> covs, double filter_time);
 
   Eigen::VectorXd state();
@@ -65,7 +67,7 @@ public:
   extra_routine_t get_extra_routine(const std::string& routine);
 
 private:
-  std::deque<Observation> rewind(double t);
+  void rewind(double t);
   void checkpoint(Observation& obs);
 
   Estimate predict_and_update_batch(Observation& obs, bool augment);
@@ -98,11 +100,17 @@ private:
   // process noise
   MatrixXdr Q;
 
-  // rewind stuff
+  // rewind stuff, the filter after each of the last rewind_to_keep observations. without any, observations
+  // from before the filter time are dropped
+  struct Checkpoint {
+    double t;
+    Eigen::VectorXd x;
+    MatrixXdr P;
+    Observation obs;
+  };
   double max_rewind_age;
-  std::deque<double> rewind_t;
-  std::deque<std::pair<Eigen::VectorXd, MatrixXdr>> rewind_states;
-  std::deque<Observation> rewind_obscache;
+  RingBuffer<Checkpoint> rewind_history;
+  RingBuffer<Observation> rewound;  // observations undone by a rewind, to fast forward through
 
   Eigen::VectorXd augment_times;
 
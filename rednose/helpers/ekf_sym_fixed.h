@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "common_ekf.h"
+#include "ekf_sym.h"
+#include "ring_buffer.h"
+#include "logger/logger.h"
+
+namespace EKFS {
+
+// EKFSym with the state, error state and largest observation dimensions known at build time, for filters
+// used from c++. state, covariance and observations are fixed size (observations up to MAX_ZDIM rows), so
+// predict and update work without heap temporaries. observations are applied one at a time, there is no
+// msckf augmentation. EKFSym stays the filter for python
+template <int DIM, int EDIM, int MAX_ZDIM>
+class EKFSymFixed {
+public:
+  typedef Eigen::Matrix<double, DIM, 1> StateVec;
+  typedef Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor> CovMat;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::ColMajor, MAX_ZDIM, 1> ObsVec;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor, MAX_ZDIM, MAX_ZDIM> ObsMat;
+
+  struct Observation {
+    double t;
+    int kind;
+    ObsVec z;
+    ObsMat R;
+  };
+
+  EKFSymFixed(const std::string &name, const CovMat &Q, const StateVec &x_initial, const CovMat &P_initial,
+      std::vector<int> quaternion_idxs = std::vector<int>(), double max_rewind_age = 1.0,
+      int rewind_to_keep = REWIND_TO_KEEP);
+  void init_state(const StateVec &state, const CovMat &covs, double filter_time);
+
+  const StateVec &state() const { return this->x; }
+  const CovMat &covs() const { return this->P; }
+  void set_filter_time(double t) { this->filter_time = t; }
+  double get_filter_time() const { return this->filter_time; }
+  void reset_rewind();
+
+  void predict(double t);
+  // predicts to t and updates with the observation z of kind, with noise R. an observation from before the
+  // filter time is applied after rewinding to it, and the later observations are replayed.
+  // returns false if it's too old for that
+  bool predict_and_update(double t, int kind, const ObsVec &z, const ObsMat &R);
+
+  extra_routine_t get_extra_routine(const std::string &routine) const { return this->ekf->extra_routines.at(routine); }
+
+private:
+  void rewind(double t);
+  void checkpoint(const Observation &obs);
+
+  void predict_and_update(const Observation &obs);
+  void update(int kind, ObsVec z, ObsMat R);
+  void normalize_quaternions();
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  StateVec x;  // state
+  CovMat P;  // covs
+  CovMat Q;  // process noise
+
+  double filter_time;
+  std::vector<int> quaternion_idxs;
+
+  // rewind stuff, the filter after each of the last rewind_to_keep observations, allocated once. without
+  // any, observations from before the filter time are dropped
+  struct Checkpoint {
+    double t;
+    StateVec x;
+    CovMat P;
+    Observation obs;
+  };
+  double max_rewind_age;
+  RingBuffer<Checkpoint> rewind_history;
+  RingBuffer<Observation> rewound;  // observations undone by a rewind, to fast forward through
+};
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+EKFSymFixed<DIM, EDIM, MAX_ZDIM>::EKFSymFixed(const std::string &name, const CovMat &Q, const StateVec &x_initial,
+    const CovMat &P_initial, std::vector<int> quaternion_idxs, double max_rewind_age, int rewind_to_keep)
+  : rewind_history(rewind_to_keep), rewound(rewind_to_keep) {
+  this->ekf = ekf_lookup(name);
+  assert(this->ekf);
+
+  this->Q = Q;
+  this->quaternion_idxs = quaternion_idxs;
+  this->max_rewind_age = max_rewind_age;
+  this->init_state(x_initial, P_initial, NAN);
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::init_state(const StateVec &state, const CovMat &covs, double init_filter_time) {
+  this->x = state;
+  this->P = covs;
+  this->filter_time = init_filter_time;
+  this->reset_rewind();
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::reset_rewind() {
+  this->rewind_history.clear();
+  this->rewound.clear();
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+bool EKFSymFixed<DIM, EDIM, MAX_ZDIM>::predict_and_update(double t, int kind, const ObsVec &z, const ObsMat &R) {
+  this->rewound.clear();
+  if (!std::isnan(this->filter_time) && t < this->filter_time) {
+    if (this->rewind_history.empty() || t < this->rewind_history.front().t ||
+        t < this->rewind_history.back().t - this->max_rewind_age) {
+      LOGD("observation too old at %f with filter at %f, ignoring!", t, this->filter_time);
+      return false;
+    }
+    this->rewind(t);
+  }
+
+  this->predict_and_update(Observation{t, kind, z, R});
+
+  // optional fast forward
+  for (size_t i = 0; i < this->rewound.size(); i++) {
+    this->predict_and_update(this->rewound[i]);
+  }
+  return true;
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::rewind(double t) {
+  // rewind observations until t is after previous observation
+  size_t keep = this->rewind_history.size();
+  while (this->rewind_history[keep - 1].t > t) {
+    keep--;
+  }
+  for (size_t i = keep; i < this->rewind_history.size(); i++) {
+    this->rewound.push_back(this->rewind_history[i].obs);
+  }
+  while (this->rewind_history.size() > keep) {
+    this->rewind_history.pop_back();
+  }
+
+  // set the state to the time right before that
+  const Checkpoint &last = this->rewind_history.back();
+  this->filter_time = last.t;
+  this->x = last.x;
+  this->P = last.P;
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::checkpoint(const Observation &obs) {
+  if (this->rewind_history.capacity() == 0) {
+    return;
+  }
+
+  // push to rewinder, once full this overwrites the oldest
+  Checkpoint &c = this->rewind_history.push_back();
+  c.t = this->filter_time;
+  c.x = this->x;
+  c.P = this->P;
+  c.obs = obs;
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::predict_and_update(const Observation &obs) {
+  this->predict(obs.t);
+  this->update(obs.kind, obs.z, obs.R);
+  this->checkpoint(obs);
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::predict(double t) {
+  // initialize time
+  if (std::isnan(this->filter_time)) {
+    this->filter_time = t;
+  }
+
+  // predict
+  double dt = t - this->filter_time;
+  assert(dt >= 0.0);
+
+  // nothing to predict for another observation at the filter time, predicting over 0s leaves x and P as
+  // they are
+  if (dt == 0.0) {
+    this->normalize_quaternions();
+    return;
+  }
+
+  this->ekf->predict(this->x.data(), this->P.data(), this->Q.data(), dt);
+  this->normalize_quaternions();
+  this->filter_time = t;
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::update(int kind, ObsVec z, ObsMat R) {
+  assert(z.rows() == R.rows());
+  assert(z.rows() == R.cols());
+
+  // no extra args, those are only used by msckf feature kinds
+  this->ekf->updates.at(kind)(this->x.data(), this->P.data(), z.data(), R.data(), NULL);
+  this->normalize_quaternions();
+}
+
+template <int DIM, int EDIM, int MAX_ZDIM>
+void EKFSymFixed<DIM, EDIM, MAX_ZDIM>::normalize_quaternions() {
+  for (int idx : this->quaternion_idxs) {
+    this->x.template segment<4>(idx).normalize();
+  }
+}
+
+}
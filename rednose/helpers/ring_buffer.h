@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace EKFS {
+
+// the last capacity elements pushed, in storage allocated once. when full, a push overwrites the
+// oldest element. elements are assigned to rather than constructed, so elements that own memory,
+// like dynamic size eigen matrices, keep it across pushes
+template <typename T>
+class RingBuffer {
+public:
+  RingBuffer(size_t capacity = 0) : buf(capacity) {}
+
+  size_t capacity() const { return this->buf.size(); }
+  size_t size() const { return this->count; }
+  bool empty() const { return this->count == 0; }
+  void clear() { this->count = 0; }
+
+  // makes room for an element after the newest and returns it, to be filled in place
+  T &push_back() {
+    assert(this->capacity() > 0);
+    if (this->count == this->capacity()) {
+      this->head = this->wrap(this->head + 1);
+    } else {
+      this->count++;
+    }
+    return this->back();
+  }
+  void push_back(const T &val) { this->push_back() = val; }
+  void pop_back() {
+    assert(this->count > 0);
+    this->count--;
+  }
+
+  // i is counted from the oldest element
+  T &operator[](size_t i) { return this->buf[this->wrap(this->head + i)]; }
+  const T &operator[](size_t i) const { return this->buf[this->wrap(this->head + i)]; }
+  T &front() { return (*this)[0]; }
+  T &back() { return (*this)[this->count - 1]; }
+
+private:
+  size_t wrap(size_t i) const { return i < this->capacity() ? i : i - this->capacity(); }
+
+  std::vector<T> buf;
+  size_t head = 0;  // index of the oldest element in buf
+  size_t count = 0;
+};
+
+}
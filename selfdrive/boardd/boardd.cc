@@ -12,6 +12,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <iterator>
 #include <thread>
 #include <unordered_map>
 
@@ -28,6 +29,7 @@
 
 #include "selfdrive/boardd/panda.h"
 #include "selfdrive/boardd/pigeon.h"
+#include "selfdrive/boardd/sim_panda.h"
 
 #define MAX_IR_POWER 0.5f
 #define MIN_IR_POWER 0.0f
@@ -39,6 +41,13 @@ Panda * panda = nullptr;
 std::atomic<bool> safety_setter_thread_running(false);
 std::atomic<bool> ignition(false);
 std::atomic<bool> pigeon_active(false);
+std::atomic<uint32_t> can_rx_latency_max_us(0);
+
+// sendcan latency, from logMonoTime to the completion of the USB transfer, since the last pandaState
+const uint32_t SENDCAN_LATENCY_BUCKETS_US[] = {250, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+std::atomic<uint32_t> sendcan_latency_hist[std::size(SENDCAN_LATENCY_BUCKETS_US) + 1];
+std::atomic<uint32_t> sendcan_latency_max_us(0);
+std::atomic<uint32_t> sendcan_dropped(0);
 
 volatile sig_atomic_t do_exit = 0;
 
@@ -114,7 +123,12 @@ bool usb_connect() {
   std::unique_ptr<Panda> tmp_panda;
   try {
     assert(panda == nullptr);
-    tmp_panda = std::make_unique<Panda>();
+    if (getenv("BOARDD_SIM")) {
+      // 40 messages at 100hz over 3 buses, about the traffic of a car
+      tmp_panda = std::make_unique<Panda>(std::make_unique<SimPanda>(SimPanda::traffic(40, 100, 3)));
+    } else {
+      tmp_panda = std::make_unique<Panda>();
+    }
   } catch (std::exception &e) {
     return false;
   }
@@ -138,8 +152,6 @@ bool usb_connect() {
 
     params.put("PandaFirmwareHex", fw_sig_hex_buf, 16);
     LOGW("fw signature: %.*s", 16, fw_sig_hex_buf);
-
-    delete[] fw_sig_buf;
   } else { return false; }
 
   // get panda serial
@@ -185,13 +197,16 @@ void usb_retry_connect() {
   LOGW("connected to board");
 }
 
-void can_recv(PubMaster &pm) {
-  kj::Array<capnp::word> can_data;
-  panda->can_receive(can_data);
-  auto bytes = can_data.asBytes();
+void can_recv(PubMaster &pm, const std::vector<uint8_t> &data) {
+  auto bytes = panda->can_unpack(data);
   pm.send("can", bytes.begin(), bytes.size());
 }
 
+static void atomic_max(std::atomic<uint32_t> &a, uint32_t v) {
+  uint32_t prev = a;
+  while (v > prev && !a.compare_exchange_weak(prev, v)) {}
+}
+
 void can_send_thread() {
   LOGD("start send thread");
 
@@ -201,6 +216,9 @@ void can_send_thread() {
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  std::vector<uint32_t> send;
+  std::vector<uint64_t> send_times;
+
   // run as fast as messages come in
   while (!do_exit && panda->connected) {
     Message * msg = subscriber->receive();
@@ -212,17 +230,22 @@ void can_send_thread() {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
-    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    // coalesce the messages queued behind it into one transfer
+    send.clear();
+    send_times.clear();
+    sendcan_dropped += Panda::can_pack_sendcan(subscriber, msg, aligned_buf, send, send_times);
 
-    //Dont send if older than 1 second
-    if (nanos_since_boot() - event.getLogMonoTime() < 1e9) {
-      if (!fake_send) {
-        panda->can_send(event.getSendcan());
+    if (!send.empty() && !fake_send) {
+      panda->can_send_packed(send);
+
+      const uint64_t done = nanos_since_boot();
+      for (uint64_t t : send_times) {
+        const uint32_t latency_us = (done - t) / 1000;
+        const auto bucket = std::lower_bound(std::begin(SENDCAN_LATENCY_BUCKETS_US), std::end(SENDCAN_LATENCY_BUCKETS_US), latency_us);
+        sendcan_latency_hist[bucket - std::begin(SENDCAN_LATENCY_BUCKETS_US)]++;
+        atomic_max(sendcan_latency_max_us, latency_us);
       }
     }
-
-    delete msg;
   }
 
   delete subscriber;
@@ -235,26 +258,51 @@ void can_recv_thread() {
   // can = 8006
   PubMaster pm({"can"});
 
-  // run at 100hz
+  // frames are received as they arrive, and published at 100hz by default. controlsd runs once per
+  // can message, so publishing as soon as frames arrive is opt in: with BOARDD_CAN_COALESCE_US set,
+  // can is also published once the oldest received frame waited that long (0 for no coalescing)
+  const char *coalesce_env = getenv("BOARDD_CAN_COALESCE_US");
+  const int64_t coalesce_ns = coalesce_env ? atoll(coalesce_env) * 1000LL : -1;
+
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
 
-  while (!do_exit && panda->connected) {
-    can_recv(pm);
+  std::vector<uint8_t> data;
+  uint64_t recv_time = 0;
+  panda->can_recv_start();
 
+  while (!do_exit && panda->connected) {
     uint64_t cur_time = nanos_since_boot();
-    int64_t remaining = next_frame_time - cur_time;
-    if (remaining > 0) {
-      std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
-    } else {
+    uint64_t deadline = next_frame_time;
+    if (!data.empty() && coalesce_ns >= 0) {
+      deadline = std::min(deadline, recv_time + coalesce_ns);
+    }
+
+    if (cur_time < deadline) {
+      panda->can_recv_poll(data, recv_time, (deadline - cur_time) / 1000);
+      continue;
+    }
+
+    if (!data.empty()) {
+      atomic_max(can_rx_latency_max_us, (cur_time - recv_time) / 1000);
+    }
+    can_recv(pm, data);
+    data.clear();
+
+    if (cur_time < next_frame_time) {
+      // published early, the next cycle starts from here
+      next_frame_time = cur_time + dt;
+    } else if (cur_time - next_frame_time >= dt) {
       if (ignition) {
-        LOGW("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
+        LOGW("missed cycles (%d) %lld", (int)((cur_time - next_frame_time) / dt), (int64_t)(next_frame_time - cur_time));
       }
-      next_frame_time = cur_time;
+      next_frame_time = cur_time + dt;
+    } else {
+      next_frame_time += dt;
     }
-
-    next_frame_time += dt;
   }
+
+  panda->can_recv_stop();
 }
 
 void panda_state_thread() {
@@ -289,6 +337,7 @@ void panda_state_thread() {
     }
 
     bool ignition_local = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
+    ignition = ignition_local;
 
     if (ignition_local) {
       no_ignition_cnt = 0;
@@ -386,6 +435,17 @@ void panda_state_thread() {
     ps.setPowerSaveEnabled((bool)(pandaState.power_save_enabled));
     ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
     ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
+    ps.setCanRxOverflows(panda->can_rx_overflows);
+    ps.setCanRxLatencyMaxUs(can_rx_latency_max_us.exchange(0));
+    ps.setCanRxTransfers(panda->can_rx_transfers.exchange(0));
+    ps.setCanRxEmptyTransfers(panda->can_rx_empty_transfers.exchange(0));
+    ps.setUsbTransfers(panda->usb_transfers.exchange(0));
+    auto sendcan_hist = ps.initSendcanLatencyHist(std::size(sendcan_latency_hist));
+    for (int j = 0; j < std::size(sendcan_latency_hist); j++) {
+      sendcan_hist.set(j, sendcan_latency_hist[j].exchange(0));
+    }
+    ps.setSendcanLatencyMaxUs(sendcan_latency_max_us.exchange(0));
+    ps.setSendcanDropped(sendcan_dropped.exchange(0));
 
     // Convert faults bitset to capnp list
     std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
@@ -495,9 +555,10 @@ void pigeon_thread() {
 
   while (!do_exit && panda->connected) {
     bool need_reset = false;
-    // bool ignition_local = ignition;
-    health_t pandaState = panda->get_state();
-    bool ignition_local = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
+    // wake up on gps data, and at 10hz at the least to follow ignition
+    pigeon->wait_for_data(100);
+    // ignition as read by panda_state_thread, so the health isn't also read from the panda here
+    bool ignition_local = ignition;
     std::string recv = pigeon->receive();
 
     // Check based on null bytes
@@ -524,9 +585,6 @@ void pigeon_thread() {
     }
 
     ignition_last = ignition_local;
-
-    // 10ms - 100 Hz
-    util::sleep_for(10);
   }
 }
 
@@ -0,0 +1,153 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/panda.h"
+#include "selfdrive/boardd/pigeon.h"
+#include "selfdrive/boardd/sim_panda.h"
+#include "selfdrive/common/benchmark.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// throughput and latency of boardd's CAN paths on a simulated panda, no hardware needed.
+// receive: the frames of the panda's traffic generators through can_recv_poll and can_unpack, as
+// can_recv_thread does, with the latency from a frame arriving at the panda to its can event built.
+// send: sendcan messages published on the sendcan socket and taken through can_pack_sendcan and
+// can_send_packed, as can_send_thread does, then returned by the panda through receive. with the
+// latency from publishing to the USB transfer and of the round trip.
+// heap allocations of boardd's side are counted per can event and sendcan message.
+// gps: pigeon_thread's loop on a pigeon behind the panda, with its wake ups and USB transfers per second.
+// usage: boardd_benchmark [seconds] [messages at 100hz] [sendcan batch]
+
+ExitHandler do_exit;
+
+static void bench_receive(double seconds, int num_msgs) {
+  auto sim = std::make_unique<SimPanda>(SimPanda::traffic(num_msgs, 100, 3));
+  SimPanda *s = sim.get();
+  Panda panda(std::move(sim));
+
+  std::vector<uint8_t> data;
+  uint64_t recv_time = 0;
+  std::vector<uint64_t> latency;
+  latency.reserve(seconds * 2000);
+  uint64_t frames = 0, unpack_ns = 0, allocs = 0;
+
+  panda.can_recv_start();
+  const uint64_t start = nanos_since_boot();
+  while (nanos_since_boot() - start < seconds * 1e9) {
+    if (panda.can_recv_poll(data, recv_time, CAN_RECV_IDLE_US) == 0) continue;
+
+    const uint64_t a = benchmark::allocations();
+    const uint64_t t = nanos_since_boot();
+    panda.can_unpack(data);
+    const uint64_t done = nanos_since_boot();
+    unpack_ns += done - t;
+    allocs += benchmark::allocations() - a;
+    latency.push_back(done - recv_time);
+    frames += data.size() / 0x10;
+    data.clear();
+  }
+  panda.can_recv_stop();
+
+  const double elapsed = (nanos_since_boot() - start) / 1e9;
+  printf("receive, %d messages at 100hz: %.0f frames/s of %.0f generated, %lu can events, %.1f ns/frame unpack, %.2f allocs/event\n",
+         num_msgs, frames / elapsed, s->frames_received / elapsed, latency.size(), frames ? (double)unpack_ns / frames : 0,
+         latency.size() ? (double)allocs / latency.size() : 0);
+  printf("  receive transfers    %.0f/s, %.0f/s empty\n", panda.can_rx_transfers / elapsed, panda.can_rx_empty_transfers / elapsed);
+  benchmark::print_percentiles("panda to can event", latency);
+}
+
+static void bench_send(double seconds, int batch) {
+  Panda panda(std::make_unique<SimPanda>(std::vector<SimCanGenerator>{}));
+
+  // can_send_thread's socket, subscribed before anything is published
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<SubSocket> subscriber(SubSocket::create(context.get(), "sendcan"));
+  assert(subscriber != NULL);
+  subscriber->setTimeout(100);
+  PubMaster pm({"sendcan"});
+
+  AlignedBuffer aligned_buf;
+  std::vector<uint32_t> send;
+  std::vector<uint64_t> send_times;
+  std::vector<uint8_t> data;
+  uint64_t recv_time = 0;
+  std::vector<uint64_t> to_usb, round_trip;
+  uint64_t frames = 0, allocs = 0, msgs = 0, dropped = 0;
+
+  panda.can_recv_start();
+  const uint64_t start = nanos_since_boot();
+  while (nanos_since_boot() - start < seconds * 1e9) {
+    MessageBuilder msg;
+    auto sendcan = msg.initEvent().initSendcan(batch);
+    for (int i = 0; i < batch; i++) {
+      const uint8_t dat[8] = {(uint8_t)i, 1, 2, 3, 4, 5, 6, 7};
+      sendcan[i].setAddress(0x200 + i);
+      sendcan[i].setSrc(i % 3);
+      sendcan[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+    }
+
+    const uint64_t t = nanos_since_boot();
+    pm.send("sendcan", msg);
+
+    // can_send_thread's loop
+    const uint64_t a = benchmark::allocations();
+    Message *m = subscriber->receive();
+    if (!m) continue;
+    send.clear();
+    send_times.clear();
+    dropped += Panda::can_pack_sendcan(subscriber.get(), m, aligned_buf, send, send_times);
+    msgs += send_times.size();
+    if (!send.empty()) {
+      panda.can_send_packed(send);
+    }
+    allocs += benchmark::allocations() - a;
+    to_usb.push_back(nanos_since_boot() - t);
+
+    const size_t sent = send.size() / 4;
+    while (data.size() / 0x10 < sent && panda.connected) {
+      panda.can_recv_poll(data, recv_time, CAN_RECV_IDLE_US);
+    }
+    round_trip.push_back(nanos_since_boot() - t);
+    frames += sent;
+    data.clear();
+  }
+  panda.can_recv_stop();
+
+  const double elapsed = (nanos_since_boot() - start) / 1e9;
+  printf("send, batches of %d: %.0f frames/s, %lu sendcan messages, %lu dropped, %.2f allocs/message\n", batch,
+         frames / elapsed, msgs, dropped, msgs ? (double)allocs / msgs : 0);
+  benchmark::print_percentiles("sendcan to USB", to_usb);
+  benchmark::print_percentiles("sendcan round trip", round_trip);
+}
+
+static void bench_gps(double seconds) {
+  Panda panda(std::make_unique<SimPanda>(std::vector<SimCanGenerator>{}));
+  std::unique_ptr<Pigeon> pigeon(Pigeon::connect(&panda));
+
+  const uint32_t transfers = panda.usb_transfers;
+  uint64_t wakes = 0;
+  const uint64_t start = nanos_since_boot();
+  while (nanos_since_boot() - start < seconds * 1e9) {
+    pigeon->wait_for_data(100);
+    pigeon->receive();
+    wakes++;
+  }
+
+  const double elapsed = (nanos_since_boot() - start) / 1e9;
+  printf("gps: %.0f wake ups/s, %.0f USB transfers/s\n", wakes / elapsed, (panda.usb_transfers - transfers) / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 5;
+  const int num_msgs = argc > 2 ? atoi(argv[2]) : 40;
+  const int batch = argc > 3 ? atoi(argv[3]) : 16;
+
+  bench_receive(seconds, num_msgs);
+  bench_send(seconds, batch);
+  bench_gps(seconds);
+  return 0;
+}
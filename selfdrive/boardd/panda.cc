@@ -2,16 +2,19 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
-Panda::Panda() {
+UsbTransport::UsbTransport() {
   // init libusb
   int err = libusb_init(&ctx);
   if (err != 0) { goto fail; }
@@ -35,14 +38,6 @@ Panda::Panda() {
   err = libusb_claim_interface(dev_handle, 0);
   if (err != 0) { goto fail; }
 
-  hw_type = get_hw_type();
-
-  //assert((hw_type != cereal::PandaState::PandaType::WHITE_PANDA) &&
-  //       (hw_type != cereal::PandaState::PandaType::GREY_PANDA));
-
-  has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
-            (hw_type == cereal::PandaState::PandaType::DOS);
-
   return;
 
 fail:
@@ -50,13 +45,13 @@ fail:
   throw std::runtime_error("Error connecting to panda");
 }
 
-Panda::~Panda() {
+UsbTransport::~UsbTransport() {
+  can_recv_stop();
   std::lock_guard lk(usb_lock);
   cleanup();
-  connected = false;
 }
 
-void Panda::cleanup() {
+void UsbTransport::cleanup() {
   if (dev_handle) {
     libusb_release_interface(dev_handle, 0);
     libusb_close(dev_handle);
@@ -67,20 +62,20 @@ void Panda::cleanup() {
   }
 }
 
-void Panda::handle_usb_issue(int err, const char func[]) {
+void UsbTransport::handle_usb_issue(int err, const char func[]) {
   LOGE_100("usb error %d \"%s\" in %s", err, libusb_strerror((enum libusb_error)err), func);
   if (err == LIBUSB_ERROR_NO_DEVICE) {
     LOGE("lost connection");
-    connected = false;
+    panda->connected = false;
   }
   // TODO: check other errors, is simply retrying okay?
 }
 
-int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) {
+int UsbTransport::control_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) {
   int err;
   const uint8_t bmRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
 
-  if (!connected) {
+  if (!panda->connected) {
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
@@ -88,16 +83,16 @@ int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigne
   do {
     err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
-  } while (err < 0 && connected);
+  } while (err < 0 && panda->connected);
 
   return err;
 }
 
-int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout) {
+int UsbTransport::control_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout) {
   int err;
   const uint8_t bmRequestType = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
 
-  if (!connected) {
+  if (!panda->connected) {
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
@@ -105,16 +100,16 @@ int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned
   do {
     err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
-  } while (err < 0 && connected);
+  } while (err < 0 && panda->connected);
 
   return err;
 }
 
-int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+int UsbTransport::bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
   int err;
   int transferred = 0;
 
-  if (!connected) {
+  if (!panda->connected) {
     return 0;
   }
 
@@ -130,16 +125,16 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
     } else if (err != 0 || length != transferred) {
       handle_usb_issue(err, __func__);
     }
-  } while(err != 0 && connected);
+  } while(err != 0 && panda->connected);
 
   return transferred;
 }
 
-int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+int UsbTransport::bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
   int err;
   int transferred = 0;
 
-  if (!connected) {
+  if (!panda->connected) {
     return 0;
   }
 
@@ -151,17 +146,212 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
     if (err == LIBUSB_ERROR_TIMEOUT) {
       break; // timeout is okay to exit, recv still happened
     } else if (err == LIBUSB_ERROR_OVERFLOW) {
-      comms_healthy = false;
+      panda->comms_healthy = false;
       LOGE_100("overflow got 0x%x", transferred);
     } else if (err != 0) {
       handle_usb_issue(err, __func__);
     }
 
-  } while(err != 0 && connected);
+  } while(err != 0 && panda->connected);
 
   return transferred;
 }
 
+void UsbTransport::can_recv_submit(CanRecvTransfer &t) {
+  // called with recv_lock held
+  int err = libusb_submit_transfer(t.transfer);
+  if (err == 0) {
+    t.in_flight = true;
+  } else {
+    handle_usb_issue(err, __func__);
+    recv_idle_since = nanos_since_boot();
+  }
+}
+
+int UsbTransport::can_recv_in_flight() {
+  // called with recv_lock held
+  return std::count_if(std::begin(recv_transfers), std::end(recv_transfers), [](auto &t) { return t.in_flight; });
+}
+
+void LIBUSB_CALL UsbTransport::can_recv_callback(libusb_transfer *transfer) {
+  CanRecvTransfer &t = *(CanRecvTransfer *)transfer->user_data;
+  UsbTransport *p = t.usb;
+
+  std::lock_guard lk(p->recv_lock);
+  t.in_flight = false;
+  bool got_frames = false;
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      p->panda->can_rx_transfers++;
+      if (transfer->actual_length == 0) {
+        p->panda->can_rx_empty_transfers++;
+        break;
+      }
+      if (transfer->actual_length == transfer->length) {
+        LOGW("Receive buffer full");
+        p->panda->can_rx_overflows++;
+      }
+      if (p->recv_data.empty()) {
+        p->recv_data_time = nanos_since_boot();
+      }
+      p->recv_data.insert(p->recv_data.end(), transfer->buffer, transfer->buffer + transfer->actual_length);
+      got_frames = true;
+      break;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      p->panda->can_rx_transfers++;
+      p->panda->comms_healthy = false;
+      p->panda->can_rx_overflows++;
+      LOGE_100("overflow got 0x%x", transfer->actual_length);
+      got_frames = true;
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      p->handle_usb_issue(LIBUSB_ERROR_NO_DEVICE, __func__);
+      return;
+    default:
+      // error, stall or timeout: retry after the idle time instead of spinning on it
+      LOGE_100("can receive failed with status %d", transfer->status);
+      break;
+  }
+
+  if (p->recv_stopping) return;
+  if (got_frames) {
+    // the panda may have more, ask again and put another idle transfer in flight
+    p->recv_idle_us = CAN_RECV_IDLE_US;
+    p->can_recv_submit(t);
+    for (CanRecvTransfer &idle : p->recv_transfers) {
+      if (!idle.in_flight) {
+        p->can_recv_submit(idle);
+        break;
+      }
+    }
+  } else if (p->can_recv_in_flight() == 0) {
+    // the last one came back empty, can_recv_poll asks again after the idle time
+    p->recv_idle_since = nanos_since_boot();
+  }
+}
+
+void UsbTransport::can_recv_start() {
+  std::lock_guard lk(recv_lock);
+  recv_stopping = false;
+  recv_idle_us = CAN_RECV_IDLE_US;
+  for (CanRecvTransfer &t : recv_transfers) {
+    t.usb = this;
+    t.transfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(t.transfer, dev_handle, 0x81, t.buf, RECV_SIZE, can_recv_callback, &t, TIMEOUT);
+  }
+  can_recv_submit(recv_transfers[0]);
+}
+
+int UsbTransport::can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us) {
+  {
+    std::lock_guard lk(recv_lock);
+    if (!recv_stopping && recv_transfers[0].transfer && can_recv_in_flight() == 0) {
+      // the panda was idle, one transfer asks again once it had time to receive frames
+      const uint64_t cur_time = nanos_since_boot();
+      const uint64_t due = recv_idle_since + recv_idle_us * 1000ULL;
+      if (cur_time >= due) {
+        can_recv_submit(recv_transfers[0]);
+        recv_idle_us = std::min(recv_idle_us * 2, CAN_RECV_IDLE_MAX_US);
+      } else {
+        timeout_us = std::min<uint64_t>(timeout_us, (due - cur_time) / 1000 + 1);
+      }
+    }
+  }
+
+  struct timeval tv = {.tv_sec = timeout_us / 1000000, .tv_usec = timeout_us % 1000000};
+  int err = libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  if (err != 0) handle_usb_issue(err, __func__);
+
+  std::lock_guard lk(recv_lock);
+  const int recv = recv_data.size();
+  if (recv > 0) {
+    if (out.empty()) {
+      recv_time = recv_data_time;
+      out.swap(recv_data);
+    } else {
+      out.insert(out.end(), recv_data.begin(), recv_data.end());
+    }
+    recv_data.clear();
+  }
+  return recv;
+}
+
+void UsbTransport::can_recv_stop() {
+  {
+    std::lock_guard lk(recv_lock);
+    recv_stopping = true;
+    for (CanRecvTransfer &t : recv_transfers) {
+      if (t.in_flight) {
+        libusb_cancel_transfer(t.transfer);
+      }
+    }
+  }
+
+  // cancelled transfers complete through the event loop, and must not be freed before, nor libusb
+  // exited by the destructor. a gone device completes them too
+  for (int i = 0; ; i++) {
+    int in_flight = 0;
+    {
+      std::lock_guard lk(recv_lock);
+      in_flight = can_recv_in_flight();
+    }
+    if (in_flight == 0) break;
+    if (i > 0 && i % 10 == 0) {
+      LOGE("waiting for %d can receive transfers to complete", in_flight);
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+
+  std::lock_guard lk(recv_lock);
+  for (CanRecvTransfer &t : recv_transfers) {
+    libusb_free_transfer(t.transfer);
+    t.transfer = nullptr;
+  }
+  recv_data.clear();
+}
+
+Panda::Panda() : Panda(std::make_unique<UsbTransport>()) {}
+
+Panda::Panda(std::unique_ptr<PandaTransport> t) : transport(std::move(t)) {
+  transport->panda = this;
+  hw_type = get_hw_type();
+
+  //assert((hw_type != cereal::PandaState::PandaType::WHITE_PANDA) &&
+  //       (hw_type != cereal::PandaState::PandaType::GREY_PANDA));
+
+  has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
+            (hw_type == cereal::PandaState::PandaType::DOS);
+}
+
+Panda::~Panda() {
+  transport->can_recv_stop();
+  transport.reset();
+  connected = false;
+}
+
+int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) {
+  usb_transfers++;
+  return transport->control_write(bRequest, wValue, wIndex, timeout);
+}
+
+int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout) {
+  usb_transfers++;
+  return transport->control_read(bRequest, wValue, wIndex, data, wLength, timeout);
+}
+
+int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  usb_transfers++;
+  return transport->bulk_write(endpoint, data, length, timeout);
+}
+
+int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  usb_transfers++;
+  return transport->bulk_read(endpoint, data, length, timeout);
+}
+
 void Panda::set_safety_model(cereal::CarParams::SafetyModel safety_model, int safety_param) {
   usb_write(0xdc, (uint16_t)safety_model, safety_param);
 }
@@ -261,43 +451,66 @@ void Panda::send_heartbeat() {
   usb_write(0xf3, 1, 0);
 }
 
-void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
-  static std::vector<uint32_t> send;
-  const int msg_count = can_data_list.size();
-
-  send.resize(msg_count*0x10);
+void Panda::can_pack(capnp::List<cereal::CanData>::Reader can_data_list, std::vector<uint32_t> &send) {
+  const size_t start = send.size();
+  send.resize(start + can_data_list.size() * 4);
 
-  for (int i = 0; i < msg_count; i++) {
-    auto cmsg = can_data_list[i];
+  uint32_t *frame = &send[start];
+  for (auto cmsg : can_data_list) {
     if (cmsg.getAddress() >= 0x800) { // extended
-      send[i*4] = (cmsg.getAddress() << 3) | 5;
+      frame[0] = (cmsg.getAddress() << 3) | 5;
     } else { // normal
-      send[i*4] = (cmsg.getAddress() << 21) | 1;
+      frame[0] = (cmsg.getAddress() << 21) | 1;
     }
     auto can_data = cmsg.getDat();
     assert(can_data.size() <= 8);
-    send[i*4+1] = can_data.size() | (cmsg.getSrc() << 4);
-    memcpy(&send[i*4+2], can_data.begin(), can_data.size());
+    frame[1] = can_data.size() | (cmsg.getSrc() << 4);
+    memcpy(&frame[2], can_data.begin(), can_data.size());
+    frame += 4;
+  }
+}
+
+int Panda::can_pack_sendcan(SubSocket *sock, Message *msg, AlignedBuffer &aligned_buf,
+                            std::vector<uint32_t> &send, std::vector<uint64_t> &send_times) {
+  int dropped = 0;
+  const uint64_t cur_time = nanos_since_boot();
+  for (; msg != NULL; msg = sock->receive(true)) {
+    capnp::FlatArrayMessageReader cmsg(message_words(aligned_buf, msg));
+    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+
+    //Dont send if older than 1 second
+    if (cur_time - event.getLogMonoTime() < 1e9) {
+      can_pack(event.getSendcan(), send);
+      send_times.push_back(event.getLogMonoTime());
+    } else {
+      dropped++;
+    }
+
+    delete msg;
   }
+  return dropped;
+}
 
-  usb_bulk_write(3, (unsigned char*)send.data(), send.size(), 5);
+int Panda::can_send_packed(const std::vector<uint32_t> &send) {
+  return usb_bulk_write(3, (unsigned char*)send.data(), send.size() * sizeof(uint32_t), 5);
 }
 
-int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
-  uint32_t data[RECV_SIZE/4];
-  int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
+void Panda::can_recv_start() {
+  transport->can_recv_start();
+}
 
-  // Not sure if this can happen
-  if (recv < 0) recv = 0;
+int Panda::can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us) {
+  return transport->can_recv_poll(out, recv_time, timeout_us);
+}
 
-  if (recv == RECV_SIZE) {
-    LOGW("Receive buffer full");
-  }
+void Panda::can_recv_stop() {
+  transport->can_recv_stop();
+}
 
-  size_t num_msg = recv / 0x10;
-  MessageBuilder msg;
-  auto evt = msg.initEvent();
-  evt.setValid(comms_healthy);
+kj::ArrayPtr<capnp::byte> Panda::can_unpack(const std::vector<uint8_t> &buf) {
+  const uint32_t *data = (const uint32_t *)buf.data();
+  size_t num_msg = buf.size() / 0x10;
+  auto evt = can_event.initEvent(comms_healthy);
 
   // populate message
   auto canData = evt.initCan(num_msg);
@@ -315,6 +528,6 @@ int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
     canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
     canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
   }
-  out_buf = capnp::messageToFlatArray(msg);
-  return recv;
+
+  return can_event.toBytes();
 }
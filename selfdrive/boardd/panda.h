@@ -3,6 +3,7 @@
 #include <atomic>
 #include <cstdint>
 #include <ctime>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <vector>
@@ -11,11 +12,22 @@
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/messaging.h"
 
 // double the FIFO size
 #define RECV_SIZE (0x1000)
 #define TIMEOUT 0
 
+// CAN receive transfers. every completion with frames resubmits its transfer and puts one more in
+// flight, so a busy panda's FIFO is drained by several at once
+#define CAN_RECV_TRANSFERS 4
+// the panda answers a receive at once when it has nothing. once all transfers came back empty, a
+// single one asks again after CAN_RECV_IDLE_US, backing off to CAN_RECV_IDLE_MAX_US while it stays empty
+#define CAN_RECV_IDLE_US 1000
+#define CAN_RECV_IDLE_MAX_US 10000
+// a can event has room for the frames of every receive transfer in flight, 3 words each
+#define CAN_EVENT_WORDS (CAN_RECV_TRANSFERS * RECV_SIZE / 0x10 * 3 + 64)
+
 // copied from panda/board/main.c
 struct __attribute__((packed)) health_t {
   uint32_t uptime;
@@ -40,7 +52,27 @@ struct __attribute__((packed)) health_t {
 };
 
 
-class Panda {
+class Panda;
+
+// how a Panda reaches its board: UsbTransport over libusb, or SimPanda in process.
+// transports report connection and receive problems into the Panda that owns them
+class PandaTransport {
+ public:
+  virtual ~PandaTransport(){};
+  Panda *panda = nullptr;
+
+  virtual int control_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) = 0;
+  virtual int control_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout) = 0;
+  virtual int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) = 0;
+  virtual int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) = 0;
+
+  // asynchronous CAN receive
+  virtual void can_recv_start() = 0;
+  virtual int can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us) = 0;
+  virtual void can_recv_stop() = 0;
+};
+
+class UsbTransport : public PandaTransport {
  private:
   libusb_context *ctx = NULL;
   libusb_device_handle *dev_handle = NULL;
@@ -48,15 +80,57 @@ class Panda {
   void handle_usb_issue(int err, const char func[]);
   void cleanup();
 
+  // asynchronous CAN receive, the callbacks run in whichever thread handles libusb events
+  struct CanRecvTransfer {
+    UsbTransport *usb = nullptr;
+    libusb_transfer *transfer = nullptr;
+    bool in_flight = false;
+    uint8_t buf[RECV_SIZE];
+  };
+  CanRecvTransfer recv_transfers[CAN_RECV_TRANSFERS];
+  std::mutex recv_lock;
+  bool recv_stopping = false;
+  uint64_t recv_idle_since = 0;  // nanos_since_boot of the last completion, when none is in flight
+  int recv_idle_us = CAN_RECV_IDLE_US;
+  std::vector<uint8_t> recv_data;  // received, not yet taken by can_recv_poll
+  uint64_t recv_data_time = 0;  // completion time of the oldest receive in recv_data
+  void can_recv_submit(CanRecvTransfer &t);
+  int can_recv_in_flight();
+  static void LIBUSB_CALL can_recv_callback(libusb_transfer *transfer);
+
  public:
-  Panda();
+  UsbTransport();
+  ~UsbTransport();
+
+  int control_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout);
+  int control_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout);
+  int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout);
+  int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout);
+
+  void can_recv_start();
+  int can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us);
+  void can_recv_stop();
+};
+
+class Panda {
+ private:
+  std::unique_ptr<PandaTransport> transport;
+
+  ReusableMessageBuilder can_event{CAN_EVENT_WORDS};
+
+ public:
+  Panda();  // the panda on USB
+  Panda(std::unique_ptr<PandaTransport> transport);
   ~Panda();
 
   std::atomic<bool> connected = true;
   std::atomic<bool> comms_healthy = true;
+  std::atomic<uint32_t> can_rx_overflows = 0;
+  std::atomic<uint32_t> can_rx_transfers = 0;  // completed CAN receive transfers
+  std::atomic<uint32_t> can_rx_empty_transfers = 0;  // of those, the ones without frames
+  std::atomic<uint32_t> usb_transfers = 0;  // control and bulk transfers, other than the CAN receive ones
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool has_rtc = false;
-
   // HW communication
   int usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout=TIMEOUT);
   int usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout=TIMEOUT);
@@ -79,6 +153,15 @@ class Panda {
   void set_power_saving(bool power_saving);
   void set_usb_power_mode(cereal::PandaState::UsbPowerMode power_mode);
   void send_heartbeat();
-  void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  int can_receive(kj::Array<capnp::word>& out_buf);
+  // appends frames in the panda's send layout, for sending several lists in one transfer
+  static void can_pack(capnp::List<cereal::CanData>::Reader can_data_list, std::vector<uint32_t> &send);
+  // packs msg and the sendcan messages queued behind it on sock, deleting them. messages younger than
+  // 1s go into send with their logMonoTime in send_times, returns the number of older ones dropped
+  static int can_pack_sendcan(SubSocket *sock, Message *msg, AlignedBuffer &aligned_buf,
+                              std::vector<uint32_t> &send, std::vector<uint64_t> &send_times);
+  int can_send_packed(const std::vector<uint32_t> &send);
+  void can_recv_start();
+  int can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us);
+  void can_recv_stop();
+  kj::ArrayPtr<capnp::byte> can_unpack(const std::vector<uint8_t> &data);  // valid until the next call
 };
@@ -1,6 +1,7 @@
 #include "selfdrive/boardd/pigeon.h"
 
 #include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -10,6 +11,7 @@
 
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/locationd/ublox_msg.h"
 
@@ -217,6 +219,11 @@ std::string PandaPigeon::receive() {
   return r;
 }
 
+void PandaPigeon::wait_for_data(int timeout_ms) {
+  // the panda can't signal gps data, it is polled every 10ms
+  util::sleep_for(std::min(timeout_ms, 10));
+}
+
 void PandaPigeon::set_power(bool power) {
   panda->usb_write(0xd9, power, 0);
 }
@@ -314,6 +321,19 @@ std::string TTYPigeon::receive() {
   return r;
 }
 
+void TTYPigeon::wait_for_data(int timeout_ms) {
+  struct pollfd fds = {.fd = pigeon_tty_fd, .events = POLLIN};
+  int err = HANDLE_EINTR(poll(&fds, 1, timeout_ms));
+  if (err < 0) { handle_tty_issue(errno, __func__); }
+
+  // poll returns on the first byte, sleep out the rest of 10ms so a burst is received at once
+  const uint64_t since_wake_ns = nanos_since_boot() - last_wake_ns;
+  if (since_wake_ns < 10000000ULL) {
+    util::sleep_for((10000000ULL - since_wake_ns + 999999) / 1000000);
+  }
+  last_wake_ns = nanos_since_boot();
+}
+
 void TTYPigeon::set_power(bool power) {
 #ifdef QCOM2
   int err = 0;
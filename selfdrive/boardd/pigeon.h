@@ -30,6 +30,8 @@ class Pigeon {
   virtual void set_baud(int baud) = 0;
   virtual void send(const std::string &s) = 0;
   virtual std::string receive() = 0;
+  // returns once there is data to receive, or after timeout_ms. returns no more often than every 10ms
+  virtual void wait_for_data(int timeout_ms) = 0;
   virtual void set_power(bool power) = 0;
 };
 
@@ -41,6 +43,7 @@ public:
   void set_baud(int baud);
   void send(const std::string &s);
   std::string receive();
+  void wait_for_data(int timeout_ms);
   void set_power(bool power);
 };
 
@@ -48,11 +51,13 @@ public:
 class TTYPigeon : public Pigeon {
   int pigeon_tty_fd = -1;
   struct termios pigeon_tty;
+  uint64_t last_wake_ns = 0;
 public:
   ~TTYPigeon();
   void connect(const char* tty);
   void set_baud(int baud);
   void send(const std::string &s);
   std::string receive();
+  void wait_for_data(int timeout_ms);
   void set_power(bool power);
 };
@@ -0,0 +1,198 @@
+#include "selfdrive/boardd/sim_panda.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "selfdrive/common/timing.h"
+
+SimPanda::SimPanda(const std::vector<SimCanGenerator> &generators, cereal::PandaState::PandaType hw_type)
+  : start_time(nanos_since_boot()), hw_type(hw_type), generators(generators), next_frame(generators.size(), UINT64_MAX) {
+  health.voltage = 12000;
+  health.current = 500;
+  health.car_harness_status = (uint8_t)cereal::PandaState::HarnessStatus::NORMAL;
+  health.safety_model = (uint8_t)cereal::CarParams::SafetyModel::SILENT;
+}
+
+std::vector<SimCanGenerator> SimPanda::traffic(int num_msgs, int hz, int num_buses) {
+  std::vector<SimCanGenerator> ret;
+  for (int i = 0; i < num_msgs; i++) {
+    ret.push_back({.address = 0x100 + (uint32_t)i, .bus = (uint8_t)(i % num_buses), .len = 8, .period_us = (uint32_t)(1000000 / hz)});
+  }
+  return ret;
+}
+
+void SimPanda::set_ignition(bool ignition) {
+  std::lock_guard lk(lock);
+  health.ignition_line = ignition;
+}
+
+int SimPanda::control_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) {
+  std::lock_guard lk(lock);
+  switch (bRequest) {
+    case 0xdc:
+      health.safety_model = wValue;
+      health.safety_param = wIndex;
+      break;
+    case 0xe5:
+      loopback = wValue;
+      break;
+    case 0xe6:
+      health.usb_power_mode = wValue;
+      break;
+    case 0xe7:
+      health.power_save_enabled = wValue;
+      break;
+    case 0xb1:
+      fan_speed = wValue * 65;  // percent to rpm
+      break;
+    case 0xf3:
+      health.heartbeat_lost = 0;
+      break;
+    default:
+      // rtc, ir power, unsafe mode and pigeon requests are accepted and ignored
+      break;
+  }
+  return 0;
+}
+
+int SimPanda::control_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout) {
+  std::lock_guard lk(lock);
+  auto reply = [&](const void *src, size_t size) {
+    size = std::min<size_t>(size, wLength);
+    memcpy(data, src, size);
+    return (int)size;
+  };
+
+  switch (bRequest) {
+    case 0xc1: {
+      const uint8_t type = (uint8_t)hw_type;
+      return reply(&type, 1);
+    }
+    case 0xd2:
+      health.uptime = (nanos_since_boot() - start_time) / 1000000000ULL;
+      return reply(&health, sizeof(health));
+    case 0xd3:
+    case 0xd4: {
+      uint8_t fw_sig[64];
+      memset(fw_sig, bRequest, sizeof(fw_sig));
+      return reply(fw_sig, sizeof(fw_sig));
+    }
+    case 0xd0:
+      return reply("0000000000000000", 16);
+    case 0xb2:
+      return reply(&fan_speed, sizeof(fan_speed));
+    default:
+      // the rtc and the pigeon have nothing to say
+      return 0;
+  }
+}
+
+int SimPanda::bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  if (endpoint != 3) return length;
+
+  std::lock_guard lk(lock);
+  const uint64_t cur_time = nanos_since_boot();
+  const uint32_t bus_time = (cur_time / 1000) & 0xFFFF;
+  if (returned.empty()) {
+    returned_time = cur_time;
+  }
+  for (int i = 0; i + 0x10 <= length; i += 0x10) {
+    uint32_t f[4];
+    memcpy(f, data + i, sizeof(f));
+    f[0] &= ~1U;  // transmit request
+    f[1] = (f[1] & 0xFFFF) | (bus_time << 16);
+    returned.insert(returned.end(), {f[0], f[1] | (0x80 << 4), f[2], f[3]});
+    if (loopback) {
+      returned.insert(returned.end(), {f[0], f[1], f[2], f[3]});
+    }
+    frames_sent++;
+  }
+  cv.notify_all();
+  return length;
+}
+
+int SimPanda::bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  if (endpoint != 0x81) return 0;
+
+  std::vector<uint8_t> out;
+  uint64_t recv_time = 0;
+  std::lock_guard lk(lock);
+  const int recv = take_frames(out, recv_time, length);
+  memcpy(data, out.data(), recv);
+  return recv;
+}
+
+void SimPanda::can_recv_start() {
+  std::lock_guard lk(lock);
+  const uint64_t cur_time = nanos_since_boot();
+  for (int i = 0; i < generators.size(); i++) {
+    next_frame[i] = cur_time + generators[i].period_us * 1000ULL;
+  }
+}
+
+int SimPanda::can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us) {
+  std::unique_lock lk(lock);
+  const uint64_t deadline = nanos_since_boot() + timeout_us * 1000ULL;
+  while (true) {
+    const uint64_t cur_time = nanos_since_boot();
+    const uint64_t next = next_frame.empty() ? UINT64_MAX : *std::min_element(next_frame.begin(), next_frame.end());
+    if (!returned.empty() || next <= cur_time || cur_time >= deadline) break;
+    cv.wait_for(lk, std::chrono::nanoseconds(std::min(next, deadline) - cur_time));
+  }
+  // a poll stands for one receive transfer
+  const int recv = take_frames(out, recv_time, SIZE_MAX);
+  panda->can_rx_transfers++;
+  if (recv == 0) panda->can_rx_empty_transfers++;
+  return recv;
+}
+
+void SimPanda::can_recv_stop() {
+  std::lock_guard lk(lock);
+  std::fill(next_frame.begin(), next_frame.end(), UINT64_MAX);
+  cv.notify_all();
+}
+
+size_t SimPanda::take_frames(std::vector<uint8_t> &out, uint64_t &recv_time, size_t max_bytes) {
+  // called with lock held, appends the frames received by now in the panda's receive layout
+  const uint64_t cur_time = nanos_since_boot();
+  const size_t start = out.size();
+  uint64_t oldest = UINT64_MAX;
+  auto push = [&](const uint32_t f[4]) {
+    out.resize(out.size() + 0x10);
+    memcpy(out.data() + out.size() - 0x10, f, 0x10);
+  };
+
+  size_t num_returned = std::min(returned.size() / 4, max_bytes / 0x10);
+  for (size_t i = 0; i < num_returned; i++) {
+    push(&returned[i * 4]);
+  }
+  if (num_returned > 0) {
+    oldest = returned_time;
+    returned.erase(returned.begin(), returned.begin() + num_returned * 4);
+  }
+
+  for (int i = 0; i < generators.size(); i++) {
+    const SimCanGenerator &g = generators[i];
+    while (next_frame[i] <= cur_time && out.size() - start + 0x10 <= max_bytes) {
+      const uint32_t bus_time = (next_frame[i] / 1000) & 0xFFFF;
+      const uint32_t f[4] = {
+        g.address >= 0x800 ? (g.address << 3) | 4 : g.address << 21,
+        g.len | ((uint32_t)g.bus << 4) | (bus_time << 16),
+        frame_counter,
+        ~frame_counter,
+      };
+      push(f);
+      frame_counter++;
+      frames_received++;
+      oldest = std::min(oldest, next_frame[i]);
+      next_frame[i] += g.period_us * 1000ULL;
+    }
+  }
+
+  const size_t recv = out.size() - start;
+  if (start == 0 && recv > 0) {
+    recv_time = oldest;
+  }
+  return recv;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "selfdrive/boardd/panda.h"
+
+// a message the simulated panda receives every period_us
+struct SimCanGenerator {
+  uint32_t address;
+  uint8_t bus;
+  uint8_t len;
+  uint32_t period_us;
+};
+
+// an in-process panda, for running boardd and its benchmarks without hardware. it answers the
+// control requests of boardd and pigeon from its health state, receives the frames of its traffic
+// generators on schedule, and returns the frames it is sent with the returned bit (0x80) set on
+// their bus, as a panda does. in loopback mode, sent frames are also received on their bus
+class SimPanda : public PandaTransport {
+ public:
+  SimPanda(const std::vector<SimCanGenerator> &generators,
+           cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::BLACK_PANDA);
+
+  // num_msgs messages spread over num_buses buses, every message at hz
+  static std::vector<SimCanGenerator> traffic(int num_msgs, int hz, int num_buses = 1);
+
+  void set_ignition(bool ignition);
+  std::atomic<uint64_t> frames_sent = 0;
+  std::atomic<uint64_t> frames_received = 0;
+
+  int control_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout);
+  int control_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout);
+  int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout);
+  int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout);
+
+  void can_recv_start();
+  int can_recv_poll(std::vector<uint8_t> &out, uint64_t &recv_time, int timeout_us);
+  void can_recv_stop();
+
+ private:
+  std::mutex lock;
+  std::condition_variable cv;
+  const uint64_t start_time;
+  cereal::PandaState::PandaType hw_type;
+  health_t health = {};
+  uint16_t fan_speed = 0;
+  bool loopback = false;
+
+  std::vector<SimCanGenerator> generators;
+  std::vector<uint64_t> next_frame;  // nanos_since_boot each generator receives its next frame at
+  uint32_t frame_counter = 0;
+  std::vector<uint32_t> returned;  // sent frames in receive layout, not yet taken
+  uint64_t returned_time = 0;  // when the oldest of the returned frames was sent
+
+  size_t take_frames(std::vector<uint8_t> &out, uint64_t &recv_time, size_t max_bytes);
+};
@@ -156,8 +156,7 @@ class CarInterface(CarInterfaceBase):
 
   # returns a car.CarState
   def update(self, c, can_strings):
-    self.cp.update_strings(can_strings)
-    self.cp_loopback.update_strings(can_strings)
+    self.update_parsers(can_strings, self.cp, self.cp_loopback)
 
     ret = self.CS.update(self.cp, self.cp_loopback)
 
@@ -330,10 +330,7 @@ class CarInterface(CarInterfaceBase):
   # returns a car.CarState
   def update(self, c, can_strings):
     # ******************* do can recv *******************
-    self.cp.update_strings(can_strings)
-    self.cp_cam.update_strings(can_strings)
-    if self.cp_body:
-      self.cp_body.update_strings(can_strings)
+    self.update_parsers(can_strings, self.cp, self.cp_cam, self.cp_body)
 
     ret = self.CS.update(self.cp, self.cp_cam, self.cp_body)
 
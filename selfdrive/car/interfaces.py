@@ -12,6 +12,7 @@ from selfdrive.controls.lib.drive_helpers import V_CRUISE_MAX
 from selfdrive.controls.lib.events import Events
 from selfdrive.controls.lib.vehicle_model import VehicleModel
 from common.params import Params
+from opendbc.can.parser import CANDispatcher
 
 GearShifter = car.CarState.GearShifter
 EventName = car.CarEvent.EventName
@@ -42,6 +43,7 @@ class CarInterfaceBase(ABC):
       self.cp_cam = self.CS.get_cam_can_parser(CP)
       self.cp_body = self.CS.get_body_can_parser(CP)
       self.cp_loopback = self.CS.get_loopback_can_parser(CP)
+    self.can_dispatcher = None
 
     self.CC = None
     if CarController is not None:
@@ -49,6 +51,12 @@ class CarInterfaceBase(ABC):
 
     self.steer_warning_fix_enabled = Params().get_bool("SteerWarningFix")
 
+  def update_parsers(self, can_strings, *parsers):
+    # decodes each can packet once for all of the car's parsers, same as calling update_strings on each
+    if self.can_dispatcher is None:
+      self.can_dispatcher = CANDispatcher([cp for cp in parsers if cp is not None])
+    self.can_dispatcher.update_strings(can_strings)
+
   @staticmethod
   def get_pid_accel_limits(CP, current_speed, cruise_speed):
     return ACCEL_MIN, ACCEL_MAX
@@ -54,9 +54,7 @@ class CarInterface(CarInterfaceBase):
 
   # returns a car.CarState
   def update(self, c, can_strings):
-    self.cp.update_strings(can_strings)
-    self.cp_cam.update_strings(can_strings)
-    self.cp_adas.update_strings(can_strings)
+    self.update_parsers(can_strings, self.cp, self.cp_cam, self.cp_adas)
 
     ret = self.CS.update(self.cp, self.cp_adas, self.cp_cam)
 
@@ -0,0 +1,108 @@
+#include "selfdrive/common/benchmark.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <atomic>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+static std::atomic<uint64_t> allocation_count = 0;
+static std::atomic<int64_t> heap_bytes = 0;
+
+namespace benchmark {
+
+uint64_t allocations() { return allocation_count; }
+int64_t heap_in_use() { return heap_bytes; }
+
+}  // namespace benchmark
+
+#ifdef __linux__
+
+// eigen, capnp and c code allocate with malloc directly, so count there rather than in operator new,
+// which ends up in malloc too. glibc's own entry points do the allocating.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void *__libc_valloc(size_t size);
+void *__libc_pvalloc(size_t size);
+void __libc_free(void *p);
+}
+
+static inline void *counted(void *p) {
+  if (p) {
+    ++allocation_count;
+    heap_bytes += malloc_usable_size(p);
+  }
+  return p;
+}
+
+extern "C" {
+
+void *malloc(size_t size) { return counted(__libc_malloc(size)); }
+void *calloc(size_t n, size_t size) { return counted(__libc_calloc(n, size)); }
+void *memalign(size_t alignment, size_t size) { return counted(__libc_memalign(alignment, size)); }
+void *aligned_alloc(size_t alignment, size_t size) { return counted(__libc_memalign(alignment, size)); }
+void *valloc(size_t size) { return counted(__libc_valloc(size)); }
+void *pvalloc(size_t size) { return counted(__libc_pvalloc(size)); }
+
+int posix_memalign(void **p, size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  void *ret = counted(__libc_memalign(alignment, size));
+  if (!ret) return ENOMEM;
+  *p = ret;
+  return 0;
+}
+
+void *realloc(void *p, size_t size) {
+  const size_t old_size = p ? malloc_usable_size(p) : 0;
+  void *ret = __libc_realloc(p, size);
+  if (ret) {
+    // moving or growing in place both count, as they would for a vector
+    ++allocation_count;
+    heap_bytes += (int64_t)malloc_usable_size(ret) - (int64_t)old_size;
+  } else if (size == 0) {
+    heap_bytes -= old_size;
+  }
+  return ret;
+}
+
+void free(void *p) {
+  if (p) heap_bytes -= malloc_usable_size(p);
+  __libc_free(p);
+}
+
+}
+
+#else
+
+// elsewhere only what goes through operator new is counted
+#include <new>
+
+void *operator new(size_t size) {
+  void *p = malloc(size);
+  if (!p) throw std::bad_alloc();
+  ++allocation_count;
+  heap_bytes += malloc_size(p);
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  if (p) heap_bytes -= malloc_size(p);
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  operator delete(p);
+}
+
+#endif
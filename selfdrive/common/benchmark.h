@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+
+// shared by the *_benchmark programs. benchmark.cc replaces malloc and its relatives to count heap
+// allocations, so link it into benchmarks only, never into a daemon.
+namespace benchmark {
+
+// heap allocations so far by all threads, through malloc, calloc, realloc, the aligned allocators and
+// so also operator new
+uint64_t allocations();
+// bytes of heap in use, as malloc_usable_size counts them
+int64_t heap_in_use();
+
+// a stage of a benchmark, run any number of times through measure
+struct Stage {
+  const char *name = "";
+  const char *unit = "";
+  uint64_t count = 0;  // of unit, as returned by the measured function
+  uint64_t allocs = 0;
+  std::vector<uint64_t> ns;  // of every run
+
+  uint64_t total_ns() const {
+    uint64_t total = 0;
+    for (uint64_t t : ns) total += t;
+    return total;
+  }
+};
+
+template <class Fn>
+void measure(Stage &s, Fn &&fn) {
+  const uint64_t allocs = allocations();
+  const uint64_t start = nanos_since_boot();
+  s.count += fn();
+  const uint64_t ns = nanos_since_boot() - start;
+  // before ns grows, which isn't the stage's allocation
+  s.allocs += allocations() - allocs;
+  s.ns.push_back(ns);
+}
+
+struct Percentiles {
+  size_t count = 0;
+  uint64_t p50 = 0, p99 = 0, max = 0, total = 0;
+};
+
+// sorts ns
+inline Percentiles percentiles(std::vector<uint64_t> &ns) {
+  Percentiles p = {.count = ns.size()};
+  if (ns.empty()) return p;
+
+  std::sort(ns.begin(), ns.end());
+  p.p50 = ns[ns.size() / 2];
+  p.p99 = ns[ns.size() * 99 / 100];
+  p.max = ns.back();
+  for (uint64_t t : ns) p.total += t;
+  return p;
+}
+
+// "name  count  p50 us  p99 us  max us  total ms" of ns, which is sorted
+inline void print_percentiles(const char *name, std::vector<uint64_t> &ns) {
+  const Percentiles p = percentiles(ns);
+  if (p.count == 0) {
+    printf("  %-22s no samples\n", name);
+    return;
+  }
+  printf("  %-22s %8zu  p50 %9.1f us  p99 %9.1f us  max %9.1f us  total %9.1f ms\n", name, p.count, p.p50 / 1e3,
+         p.p99 / 1e3, p.max / 1e3, p.total / 1e6);
+}
+
+}  // namespace benchmark
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+import argparse
+import bz2
+import os
+import time
+import urllib.parse
+from multiprocessing.pool import ThreadPool
+
+import numpy as np
+
+from opendbc.can.parser import decode_logs
+from tools.lib.filereader import FileReader
+from tools.lib.route import Route
+
+
+def read_log(path):
+  with FileReader(path) as f:
+    dat = f.read()
+  _, ext = os.path.splitext(urllib.parse.urlparse(path).path)
+  return bz2.decompress(dat) if ext == ".bz2" else dat
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Decode CAN signals of a whole route into columnar arrays",
+                                   formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument("route", help="route name")
+  parser.add_argument("dbc", help="DBC name, e.g. toyota_nodsu_pt_generated")
+  parser.add_argument("signals", nargs="+", help="MESSAGE:SIGNAL, message by name or address")
+  parser.add_argument("--bus", type=int, default=0)
+  parser.add_argument("--out", help="save the series to this .npz file")
+  parser.add_argument("--no-checks", action="store_true",
+                      help="keep frames that fail their checksum or counter check, which are dropped by default")
+  args = parser.parse_args()
+
+  signals = []
+  for s in args.signals:
+    msg, sig = s.split(":")
+    signals.append((sig, int(msg, 0) if msg[0].isdigit() else msg))
+
+  # a batch of segments at a time, one per thread, so only that many decompressed logs are in memory
+  paths = [p for p in Route(args.route).log_paths() if p is not None]
+  batch_size = os.cpu_count() or 1
+  parts = {}
+  t_read, t_decode = 0.0, 0.0
+  with ThreadPool(batch_size) as pool:
+    for i in range(0, len(paths), batch_size):
+      t = time.monotonic()
+      logs = pool.map(read_log, paths[i:i + batch_size])
+      t_read += time.monotonic() - t
+
+      t = time.monotonic()
+      decoded = decode_logs(args.dbc, signals, logs, bus=args.bus, threads=batch_size, checks=not args.no_checks)
+      for key, times_values in decoded.items():
+        parts.setdefault(key, []).append(times_values)
+      t_decode += time.monotonic() - t
+      del logs
+  series = {key: (np.concatenate([p[0] for p in ps]), np.concatenate([p[1] for p in ps])) for key, ps in parts.items()}
+  print(f"read {len(paths)} segments in {t_read:.2f} s, decoded in {t_decode:.2f} s")
+
+  for (address, name), (times, values) in series.items():
+    if len(values):
+      print(f"{hex(address)} {name}: {len(values)} values, min {values.min():.3f}, max {values.max():.3f}")
+    else:
+      print(f"{hex(address)} {name}: no values")
+
+  if args.out:
+    np.savez(args.out, **{f"{hex(a)}_{n}_t": s[0] for (a, n), s in series.items()},
+             **{f"{hex(a)}_{n}": s[1] for (a, n), s in series.items()})
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "selfdrive/common/benchmark.h"
+#include "selfdrive/locationd/models/live_kf.h"
+
+// latency, heap allocations and heap use of locationd's kalman filter, the dynamic size EKFSym against
+// the fixed size filter LiveKalman uses, on the same observations. a stationary device at locationd's
+// rates: gyro and accel at 100hz with sensor times a few ms behind, so some observations are rewound to,
+// camera odometry at 20hz and gps at 10hz. the difference between the final states of the filters is
+// reported, it should be rounding. for the cost of the rewind history, the fixed filter also runs
+// without one on the observations in order.
+// usage: live_kf_benchmark [seconds of observations]
+
+struct Obs {
+  double t;
+  int kind;
+  Eigen::VectorXd z;
+  MatrixXdr R;
+};
+
+static std::vector<Obs> observations(double seconds) {
+  std::mt19937 rng(0);
+  std::normal_distribution<double> noise;
+  auto random_vec = [&](int n, double std) {
+    Eigen::VectorXd v(n);
+    for (int i = 0; i < n; i++) v[i] = std * noise(rng);
+    return v;
+  };
+  auto diag = [](int n, double std) {
+    MatrixXdr R = Eigen::VectorXd::Constant(n, std * std).asDiagonal();
+    return R;
+  };
+  auto obs_noise = [](int kind) {
+    MatrixXdr R = live_obs_noise_diag.at(kind).asDiagonal();
+    return R;
+  };
+
+  // gravity in the device frame, as the accelerometer measures it
+  const Eigen::Vector3d ecef_pos = live_initial_x.segment<STATE_ECEF_POS_LEN>(STATE_ECEF_POS_START);
+  const Eigen::Vector4d q = live_initial_x.segment<STATE_ECEF_ORIENTATION_LEN>(STATE_ECEF_ORIENTATION_START);
+  const Eigen::Matrix3d device_from_ecef = Eigen::Quaterniond(q[0], q[1], q[2], q[3]).toRotationMatrix().transpose();
+  const Eigen::Vector3d gravity = device_from_ecef * (EARTH_GM / std::pow(ecef_pos.norm(), 3) * ecef_pos);
+
+  std::vector<Obs> ret;
+  for (int i = 0; i < seconds * 100; i++) {
+    const double t = i * 0.01;
+    const double sensor_t = t - (i % 4) * 0.003;
+    // the accel is read right before the gyro, every 20th message also has the readings of 5ms before,
+    // and every 50th has two gyro readings at the same time, which share the filter's predict
+    for (double dt : i % 20 == 0 ? std::vector<double>{0.005, 0.0} : std::vector<double>{0.0}) {
+      for (int j = 0; j < (i % 50 == 0 && dt == 0.0 ? 2 : 1); j++) {
+        ret.push_back({sensor_t - dt, OBSERVATION_PHONE_GYRO, random_vec(3, 0.01), obs_noise(OBSERVATION_PHONE_GYRO)});
+      }
+      ret.push_back({sensor_t - dt - 0.0004, OBSERVATION_PHONE_ACCEL, gravity + random_vec(3, 0.2),
+                     obs_noise(OBSERVATION_PHONE_ACCEL)});
+    }
+    if (i % 5 == 0) {
+      ret.push_back({t, OBSERVATION_CAMERA_ODO_ROTATION, random_vec(3, 0.01), diag(3, 0.1)});
+      ret.push_back({t, OBSERVATION_CAMERA_ODO_TRANSLATION, random_vec(3, 0.05), diag(3, 0.5)});
+    }
+    if (i % 10 == 0) {
+      ret.push_back({t, OBSERVATION_ECEF_POS, ecef_pos + random_vec(3, 5.0), diag(3, 5.0)});
+      ret.push_back({t, OBSERVATION_ECEF_VEL, random_vec(3, 0.5), diag(3, 0.5)});
+    }
+  }
+  return ret;
+}
+
+struct Result {
+  benchmark::Stage stage;  // counts observations
+  int64_t heap = 0;  // heap used by the filter at the end
+  Eigen::VectorXd x;
+  MatrixXdr P;
+};
+
+static void run(Result &r, std::vector<Obs> &obs, std::function<void(Obs &)> observe) {
+  for (Obs &o : obs) {
+    benchmark::measure(r.stage, [&]() {
+      observe(o);
+      return 1;
+    });
+  }
+}
+
+static void print_result(const char *name, Result &r, double seconds) {
+  const benchmark::Percentiles p = benchmark::percentiles(r.stage.ns);
+  printf("  %-12s %8.2f us/obs  p99 %8.2f us/call  max %8.2f us/call  %6.2f allocs/obs  %8.0f kB heap  %5.2f%% of a core at these rates\n",
+         name, p.total / 1e3 / r.stage.count, p.p99 / 1e3, p.max / 1e3, (double)r.stage.allocs / r.stage.count,
+         r.heap / 1e3, p.total / 1e7 / seconds);
+}
+
+int main(int argc, char *argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 60;
+  std::vector<Obs> obs = observations(seconds);
+
+  std::vector<Obs> in_order = obs;
+  std::stable_sort(in_order.begin(), in_order.end(), [](const Obs &a, const Obs &b) { return a.t < b.t; });
+
+  Eigen::VectorXd initial_x = live_initial_x;
+  MatrixXdr initial_P = live_initial_P_diag.asDiagonal();
+  MatrixXdr Q = live_Q_diag.asDiagonal();
+  Result d, f, n;
+  d.stage.ns.reserve(obs.size());
+  f.stage.ns.reserve(obs.size());
+  n.stage.ns.reserve(obs.size());
+
+  {
+    const int64_t heap = benchmark::heap_in_use();
+    EKFSym dynamic("live", get_mapmat(Q), get_mapvec(initial_x), get_mapmat(initial_P), LIVE_DIM, LIVE_EDIM,
+                   0, 0, 0, std::vector<int>(), std::vector<int>{3}, std::vector<std::string>(), 0.2);
+    run(d, obs, [&](Obs &o) {
+      dynamic.predict_and_update_batch(o.t, o.kind, {get_mapvec(o.z)}, {get_mapmat(o.R)});
+    });
+    d.heap = benchmark::heap_in_use() - heap;
+    d.x = dynamic.state();
+    d.P = dynamic.covs();
+  }
+  {
+    const int64_t heap = benchmark::heap_in_use();
+    LiveKalman fixed;
+    run(f, obs, [&](Obs &o) {
+      fixed.predict_and_observe(o.t, o.kind, o.z, o.R);
+    });
+    f.heap = benchmark::heap_in_use() - heap;
+    f.x = fixed.get_x();
+    f.P = fixed.get_P();
+  }
+  {
+    const int64_t heap = benchmark::heap_in_use();
+    LiveEKFSym no_history("live", Q, initial_x, initial_P, std::vector<int>{3}, 0.2, 0);
+    run(n, in_order, [&](Obs &o) {
+      no_history.predict_and_update(o.t, o.kind, o.z, o.R);
+    });
+    n.heap = benchmark::heap_in_use() - heap;
+  }
+
+  printf("%zu observations over %.0f s:\n", obs.size(), seconds);
+  print_result("dynamic", d, seconds);
+  print_result("fixed", f, seconds);
+  print_result("no history", n, seconds);
+  printf("final difference: state %g, covariance %g\n", (d.x - f.x).cwiseAbs().maxCoeff(), (d.P - f.P).cwiseAbs().maxCoeff());
+  return 0;
+}
@@ -223,7 +223,7 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
       auto v = sensor_reading.getGyroUncalibrated().getV();
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ROTATION_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_GYRO, { meas });
+        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_GYRO, meas);
       }
     }
 
@@ -238,7 +238,7 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
 
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ACCEL_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_ACCEL, { meas });
+        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_ACCEL, meas);
       }
     }
   }
@@ -256,8 +256,8 @@ void Localizer::input_fake_gps_observations(double current_time) {
   MatrixXdr ecef_pos_R = this->kf->get_fake_gps_pos_cov();
   MatrixXdr ecef_vel_R = this->kf->get_fake_gps_vel_cov();
   
-  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_POS, { ecef_pos }, { ecef_pos_R });
-  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_VEL, { ecef_vel }, { ecef_vel_R });
+  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_POS, ecef_pos, ecef_pos_R);
+  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_VEL, ecef_vel, ecef_vel_R);
 }
 
 void Localizer::handle_gps(double current_time, const cereal::GpsLocationData::Reader& log) {
@@ -303,21 +303,21 @@ void Localizer::handle_gps(double current_time, const cereal::GpsLocationData::R
   if (ecef_vel.norm() > 5.0 && orientation_error.norm() > 1.0) {
     LOGE("Locationd vs ubloxLocation orientation difference too large, kalman reset");
     this->reset_kalman(NAN, initial_pose_ecef_quat, ecef_pos, ecef_vel, ecef_pos_R, ecef_vel_R);
-    this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_ORIENTATION_FROM_GPS, { initial_pose_ecef_quat });
+    this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_ORIENTATION_FROM_GPS, initial_pose_ecef_quat);
   } else if (gps_est_error > 100.0) {
     LOGE("Locationd vs ubloxLocation position difference too large, kalman reset");
     this->reset_kalman(NAN, initial_pose_ecef_quat, ecef_pos, ecef_vel, ecef_pos_R, ecef_vel_R);
   }
 
-  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_POS, { ecef_pos }, { ecef_pos_R });
-  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_VEL, { ecef_vel }, { ecef_vel_R });
+  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_POS, ecef_pos, ecef_pos_R);
+  this->kf->predict_and_observe(current_time, OBSERVATION_ECEF_VEL, ecef_vel, ecef_vel_R);
 }
 
 void Localizer::handle_car_state(double current_time, const cereal::CarState::Reader& log) {
   this->car_speed = std::abs(log.getVEgo());
   if (log.getStandstill()) {
-    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ROT, { Vector3d(0.0, 0.0, 0.0) });
-    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ACCEL, { Vector3d(0.0, 0.0, 0.0) });
+    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ROT, Vector3d(0.0, 0.0, 0.0));
+    this->kf->predict_and_observe(current_time, OBSERVATION_NO_ACCEL, Vector3d(0.0, 0.0, 0.0));
   }
 }
 
@@ -348,10 +348,8 @@ void Localizer::handle_cam_odo(double current_time, const cereal::CameraOdometry
   rot_calib_std *= 10.0;
   MatrixXdr rot_device_cov = rotate_std(this->device_from_calib, rot_calib_std).array().square().matrix().asDiagonal();
   MatrixXdr trans_device_cov = rotate_std(this->device_from_calib, trans_calib_std).array().square().matrix().asDiagonal();
-  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_ROTATION,
-    { rot_device }, { rot_device_cov });
-  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_TRANSLATION,
-    { trans_device }, { trans_device_cov });
+  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_ROTATION, rot_device, rot_device_cov);
+  this->kf->predict_and_observe(current_time, OBSERVATION_CAMERA_ODO_TRANSLATION, trans_device, trans_device_cov);
 }
 
 void Localizer::handle_live_calib(double current_time, const cereal::LiveCalibrationData::Reader& log) {
@@ -537,10 +535,3 @@ int Localizer::locationd_thread() {
   }
   return 0;
 }
-
-int main() {
-  util::set_realtime_priority(5);
-
-  Localizer localizer;
-  return localizer.locationd_thread();
-}
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "selfdrive/common/benchmark.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/locationd.h"
+#include "selfdrive/ui/replay/util.h"
+
+// locationd on logs, as fast as it goes, no car needed. the sensorEvents, gpsLocationExternal, carState,
+// cameraOdometry and liveCalibration of the logs go through Localizer::handle_msg_bytes in logMonoTime
+// order, and a liveLocationKalman is built after every cameraOdometry, both as locationd_thread does
+// with one message per SubMaster update. the alive and valid flags its SubMaster would keep are derived
+// from the logMonoTime and valid flag of the messages, and the time to handle every message is
+// recorded. the liveLocationKalmans can be saved as a log, and compared to those saved by an earlier
+// build, measurement by measurement. a run is deterministic, the same build on the same logs gives the
+// same liveLocationKalmans.
+// usage: locationd_benchmark [--save out.rlog] [--compare baseline.rlog] [--tolerance 1e-6] rlog(.bz2)...
+
+struct LogEvent {
+  uint64_t mono_time;
+  cereal::Event::Which which;
+  bool valid;
+  kj::ArrayPtr<const capnp::word> words;
+};
+
+static const std::pair<cereal::Event::Which, const char *> INPUTS[] = {
+  {cereal::Event::SENSOR_EVENTS, "sensorEvents"},
+  {cereal::Event::GPS_LOCATION_EXTERNAL, "gpsLocationExternal"},
+  {cereal::Event::CAR_STATE, "carState"},
+  {cereal::Event::CAMERA_ODOMETRY, "cameraOdometry"},
+  {cereal::Event::LIVE_CALIBRATION, "liveCalibration"},
+};
+
+typedef cereal::LiveLocationKalman::Measurement::Reader (cereal::LiveLocationKalman::Reader::*MeasurementGetter)() const;
+static const std::pair<const char *, MeasurementGetter> MEASUREMENTS[] = {
+  {"positionECEF", &cereal::LiveLocationKalman::Reader::getPositionECEF},
+  {"positionGeodetic", &cereal::LiveLocationKalman::Reader::getPositionGeodetic},
+  {"velocityECEF", &cereal::LiveLocationKalman::Reader::getVelocityECEF},
+  {"velocityNED", &cereal::LiveLocationKalman::Reader::getVelocityNED},
+  {"velocityDevice", &cereal::LiveLocationKalman::Reader::getVelocityDevice},
+  {"accelerationDevice", &cereal::LiveLocationKalman::Reader::getAccelerationDevice},
+  {"orientationECEF", &cereal::LiveLocationKalman::Reader::getOrientationECEF},
+  {"calibratedOrientationECEF", &cereal::LiveLocationKalman::Reader::getCalibratedOrientationECEF},
+  {"orientationNED", &cereal::LiveLocationKalman::Reader::getOrientationNED},
+  {"angularVelocityDevice", &cereal::LiveLocationKalman::Reader::getAngularVelocityDevice},
+  {"calibratedOrientationNED", &cereal::LiveLocationKalman::Reader::getCalibratedOrientationNED},
+  {"velocityCalibrated", &cereal::LiveLocationKalman::Reader::getVelocityCalibrated},
+  {"accelerationCalibrated", &cereal::LiveLocationKalman::Reader::getAccelerationCalibrated},
+  {"angularVelocityCalibrated", &cereal::LiveLocationKalman::Reader::getAngularVelocityCalibrated},
+};
+
+// the events of a log of one of the kinds in which, pointing into raw
+static bool parse_log(const std::string &raw, const std::vector<cereal::Event::Which> &which, std::vector<LogEvent> &events) {
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw.data(), raw.size() / sizeof(capnp::word));
+  try {
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      cereal::Event::Reader event = reader.getRoot<cereal::Event>();
+      if (std::find(which.begin(), which.end(), event.which()) != which.end()) {
+        events.push_back({event.getLogMonoTime(), event.which(), event.getValid(), kj::arrayPtr(words.begin(), reader.getEnd())});
+      }
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception &e) {
+    printf("failed to parse log: %s\n", e.getDescription().cStr());
+    return !events.empty();
+  }
+  return true;
+}
+
+// the alive and valid flags locationd_thread's SubMaster keeps of the inputs, with logMonoTime as its clock:
+// valid as the latest message, alive when received within 10 periods of the service's frequency.
+// gpsLocationExternal needn't be alive
+class InputFlags {
+ public:
+  InputFlags() {
+    for (auto &[which, name] : INPUTS) {
+      auto serv = std::find_if(std::begin(services), std::end(services), [&](const service &sv) { return strcmp(sv.name, name) == 0; });
+      assert(serv != std::end(services));
+      flags[which] = {.freq = serv->frequency, .ignore_alive = strcmp(name, "gpsLocationExternal") == 0};
+    }
+  }
+
+  void update(const LogEvent &e) {
+    Flags &f = flags.at(e.which);
+    f.rcv_time = e.mono_time;
+    f.valid = e.valid;
+    for (auto &[which, g] : flags) {
+      g.alive = g.freq <= 1e-5 || (e.mono_time - g.rcv_time) * 1e-9 < 10.0 / g.freq;
+    }
+  }
+
+  bool alive_and_valid(cereal::Event::Which which) const {
+    const Flags &f = flags.at(which);
+    return f.alive && f.valid;
+  }
+
+  bool all_alive_and_valid() const {
+    return std::all_of(flags.begin(), flags.end(), [](auto &kv) { return kv.second.valid && (kv.second.alive || kv.second.ignore_alive); });
+  }
+
+ private:
+  struct Flags {
+    double freq = 0;
+    bool ignore_alive = false;
+    uint64_t rcv_time = 0;
+    bool valid = true, alive = false;
+  };
+  std::map<cereal::Event::Which, Flags> flags;
+};
+
+static std::string read_log(const std::string &fn) {
+  std::string raw = util::read_file(fn);
+  if (fn.size() > 4 && fn.compare(fn.size() - 4, 4, ".bz2") == 0) {
+    raw = decompressBZ2(raw);
+  }
+  return raw;
+}
+
+// the largest difference of every measurement between the liveLocationKalmans of out and baseline,
+// returns whether all are within tolerance
+static bool compare(const std::string &out, const std::string &baseline, double tolerance) {
+  std::vector<LogEvent> a, b;
+  parse_log(out, {cereal::Event::LIVE_LOCATION_KALMAN}, a);
+  parse_log(baseline, {cereal::Event::LIVE_LOCATION_KALMAN}, b);
+  if (a.size() != b.size()) {
+    printf("liveLocationKalman count differs: %zu, baseline %zu\n", a.size(), b.size());
+  }
+
+  const size_t n = std::min(a.size(), b.size());
+  std::map<std::string, double> value_diff, std_diff;
+  int time_mismatches = 0, valid_mismatches = 0, status_mismatches = 0, first_diff = -1;
+  for (size_t i = 0; i < n; i++) {
+    capnp::FlatArrayMessageReader reader_a(a[i].words), reader_b(b[i].words);
+    const auto lla = reader_a.getRoot<cereal::Event>().getLiveLocationKalman();
+    const auto llb = reader_b.getRoot<cereal::Event>().getLiveLocationKalman();
+    time_mismatches += a[i].mono_time != b[i].mono_time;
+    status_mismatches += lla.getStatus() != llb.getStatus() || lla.getGpsOK() != llb.getGpsOK() ||
+                         lla.getPosenetOK() != llb.getPosenetOK() || lla.getExcessiveResets() != llb.getExcessiveResets();
+
+    bool same = true;
+    for (auto &[name, get] : MEASUREMENTS) {
+      const auto ma = (lla.*get)(), mb = (llb.*get)();
+      valid_mismatches += ma.getValid() != mb.getValid();
+      auto diff = [&](capnp::List<double>::Reader x, capnp::List<double>::Reader y, double &max_diff) {
+        if (x.size() != y.size()) {
+          max_diff = INFINITY;
+          return;
+        }
+        for (int j = 0; j < x.size(); j++) {
+          // nans in the same place are the same
+          const double d = std::isnan(x[j]) && std::isnan(y[j]) ? 0.0 : std::abs(x[j] - y[j]);
+          max_diff = std::max(max_diff, std::isnan(d) ? INFINITY : d);
+          same &= d <= tolerance;
+        }
+      };
+      diff(ma.getValue(), mb.getValue(), value_diff[name]);
+      diff(ma.getStd(), mb.getStd(), std_diff[name]);
+    }
+    if (!same && first_diff < 0) first_diff = i;
+  }
+
+  bool ok = a.size() == b.size() && time_mismatches == 0 && valid_mismatches == 0 && status_mismatches == 0;
+  printf("against baseline, %zu liveLocationKalman, largest differences:\n", n);
+  for (auto &[name, get] : MEASUREMENTS) {
+    printf("  %-26s value %-12g std %-12g\n", name, value_diff[name], std_diff[name]);
+    ok &= value_diff[name] <= tolerance && std_diff[name] <= tolerance;
+  }
+  printf("  logMonoTime differs in %d, a valid flag in %d, the status in %d\n", time_mismatches, valid_mismatches, status_mismatches);
+  if (first_diff >= 0) {
+    printf("  first difference above %g in message %d, %.3f s into the log\n", tolerance, first_diff,
+           (b[first_diff].mono_time - b[0].mono_time) / 1e9);
+  }
+  printf("%s\n", ok ? "same as baseline" : "DIFFERENT from baseline");
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  std::string save_fn, compare_fn;
+  double tolerance = 1e-6;
+  std::vector<std::string> log_fns;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--save" && i + 1 < argc) {
+      save_fn = argv[++i];
+    } else if (arg == "--compare" && i + 1 < argc) {
+      compare_fn = argv[++i];
+    } else if (arg == "--tolerance" && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else {
+      log_fns.push_back(arg);
+    }
+  }
+  if (log_fns.empty()) {
+    printf("usage: %s [--save out.rlog] [--compare baseline.rlog] [--tolerance 1e-6] rlog(.bz2)...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<cereal::Event::Which> inputs;
+  for (auto &[which, name] : INPUTS) inputs.push_back(which);
+  std::vector<std::string> raws(log_fns.size());
+  std::vector<LogEvent> events;
+  for (int i = 0; i < log_fns.size(); i++) {
+    raws[i] = read_log(log_fns[i]);
+    if (raws[i].empty() || !parse_log(raws[i], inputs, events)) {
+      printf("failed to read %s\n", log_fns[i].c_str());
+      return 1;
+    }
+  }
+  std::stable_sort(events.begin(), events.end(), [](const LogEvent &l, const LogEvent &r) { return l.mono_time < r.mono_time; });
+  if (events.empty()) {
+    printf("no locationd inputs in the logs\n");
+    return 1;
+  }
+
+  Localizer localizer;
+  InputFlags sm;
+  bool filter_initialized = false;
+  std::map<cereal::Event::Which, std::vector<uint64_t>> handle_ns;
+  std::vector<uint64_t> output_ns;
+  std::string out;
+  const uint64_t start = nanos_since_boot();
+  for (const LogEvent &e : events) {
+    sm.update(e);
+    if (filter_initialized) {
+      const kj::ArrayPtr<const capnp::byte> bytes = e.words.asBytes();
+      const uint64_t t = nanos_since_boot();
+      localizer.handle_msg_bytes((const char *)bytes.begin(), bytes.size());
+      handle_ns[e.which].push_back(nanos_since_boot() - t);
+    } else {
+      filter_initialized = sm.all_alive_and_valid();
+    }
+
+    if (e.which == cereal::Event::CAMERA_ODOMETRY) {
+      const uint64_t t = nanos_since_boot();
+      MessageBuilder msg_builder;
+      kj::ArrayPtr<capnp::byte> llk = localizer.get_message_bytes(msg_builder, e.mono_time, sm.all_alive_and_valid(),
+                                                                  sm.alive_and_valid(cereal::Event::SENSOR_EVENTS),
+                                                                  localizer.isGpsOK(), filter_initialized);
+      output_ns.push_back(nanos_since_boot() - t);
+      out.append((const char *)llk.begin(), llk.size());
+    }
+  }
+  const double elapsed = (nanos_since_boot() - start) / 1e9;
+  const double log_duration = (events.back().mono_time - events.front().mono_time) / 1e9;
+
+  printf("%zu messages, %.1f s of log in %.3f s, %.0fx realtime\n", events.size(), log_duration, elapsed, log_duration / elapsed);
+  for (auto &[which, name] : INPUTS) {
+    benchmark::print_percentiles(name, handle_ns[which]);
+  }
+  benchmark::print_percentiles("liveLocationKalman", output_ns);
+
+  if (!save_fn.empty()) {
+    std::ofstream f(save_fn, std::ios::binary);
+    f.write(out.data(), out.size());
+    printf("saved %zu liveLocationKalman to %s\n", output_ns.size(), save_fn.c_str());
+  }
+
+  bool ok = true;
+  if (!compare_fn.empty()) {
+    const std::string baseline = read_log(compare_fn);
+    if (baseline.empty()) {
+      printf("failed to read %s\n", compare_fn.c_str());
+      return 1;
+    }
+    ok = compare(out, baseline, tolerance);
+  }
+  return ok ? 0 : 1;
+}
@@ -9,6 +9,7 @@
 
 #include "generated/live_kf_constants.h"
 #include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
 
 #define EARTH_GM 3.986005e14  // m^3/s^2 (gravitational constant * mass of earth)
 
@@ -19,6 +20,8 @@ Eigen::Map<MatrixXdr> get_mapmat(MatrixXdr& mat);
 std::vector<Eigen::Map<Eigen::VectorXd>> get_vec_mapvec(std::vector<Eigen::VectorXd>& vec_vec);
 std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_vec);
 
+typedef EKFSymFixed<LIVE_DIM, LIVE_EDIM, LIVE_MAX_OBS_DIM> LiveEKFSym;
+
 class LiveKalman {
 public:
   LiveKalman();
@@ -27,12 +30,13 @@ public:
   void init_state(Eigen::VectorXd& state, MatrixXdr& covs, double filter_time);
   void init_state(Eigen::VectorXd& state, double filter_time);
 
-  Eigen::VectorXd get_x();
-  MatrixXdr get_P();
+  const LiveEKFSym::StateVec& get_x();
+  const LiveEKFSym::CovMat& get_P();
   double get_filter_time();
-  std::vector<MatrixXdr> get_R(int kind, int n);
 
-  std::optional<Estimate> predict_and_observe(double t, int kind, std::vector<Eigen::VectorXd> meas, std::vector<MatrixXdr> R = {});
+  // returns false if the observation is too old to be applied
+  bool predict_and_observe(double t, int kind, const LiveEKFSym::ObsVec& meas);
+  bool predict_and_observe(double t, int kind, const LiveEKFSym::ObsVec& meas, const LiveEKFSym::ObsMat& R);
   std::optional<Estimate> predict_and_update_odo_speed(std::vector<Eigen::VectorXd> speed, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_trans(std::vector<Eigen::VectorXd> trans, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_rot(std::vector<Eigen::VectorXd> rot, double t, int kind);
@@ -49,7 +53,7 @@ public:
 private:
   std::string name = "live";
 
-  std::shared_ptr<EKFSym> filter;
+  std::shared_ptr<LiveEKFSym> filter;
 
   int dim_state;
   int dim_state_err;
@@ -60,5 +64,5 @@ private:
   MatrixXdr fake_gps_vel_cov;
   MatrixXdr reset_orientation_P;
   MatrixXdr Q;  // process noise
-  std::unordered_map<int, MatrixXdr> obs_noise;
+  std::unordered_map<int, LiveEKFSym::ObsMat> obs_noise;
 };
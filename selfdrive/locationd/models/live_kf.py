@@ -206,12 +206,16 @@ class LiveKalman():
     h = euler_rotate(in_vec[0], in_vec[1], in_vec[2]).T * (sp.Matrix([in_vec[3], in_vec[4], in_vec[5]]))
     extra_routines = [('H', h.jacobian(in_vec), [in_vec])]
 
+    max_obs_dim = max(h_sym.shape[0] for h_sym, _, _ in obs_eqs)
     gen_code(generated_dir, name, f_sym, dt, state_sym, obs_eqs, dim_state, dim_state_err, eskf_params, extra_routines=extra_routines)
 
     # write constants to extra header file for use in cpp
     live_kf_header = "#pragma once\n\n"
     live_kf_header += "#include <unordered_map>\n"
     live_kf_header += "#include <eigen3/Eigen/Dense>\n\n"
+    live_kf_header += f"#define LIVE_DIM {dim_state}\n"
+    live_kf_header += f"#define LIVE_EDIM {dim_state_err}\n"
+    live_kf_header += f"#define LIVE_MAX_OBS_DIM {max_obs_dim}\n\n"
     for state, slc in inspect.getmembers(States, lambda x: type(x) == slice):
       assert(slc.step is None)  # unsupported
       live_kf_header += f'#define STATE_{state}_START {slc.start}\n'
@@ -0,0 +1,259 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/benchmark.h"
+#include "selfdrive/locationd/ublox_msg.h"
+
+// equivalence and throughput of ubloxd's parsers, no receiver needed.
+// fuzz: random NAV-PVT, RXM-RAWX, RXM-SFRBX, MON-HW and MON-HW2 messages, garbage and messages with
+// a bad preamble in between are fed in random chunks through gen_msg and the kaitai generated
+// gen_msg_kaitai, every event must be the same apart from logMonoTime. gen_msg is meant to differ
+// where the kaitai path fails, so these must be dropped by gen_msg and aren't given to gen_msg_kaitai:
+//  - messages too short for their type, which kaitai throws on reading past the end
+//  - gps subframes of other than 10 words, which kaitai asserts on
+//  - gps subframe ids 0, 6 and 7, which kaitai keeps with the sv's subframes, so an ephemeris can be
+//    published without all of subframes 1-5
+// throughput: a stream of the messages a receiver sends every second, through both paths, with heap
+// allocations counted per message.
+// usage: ublox_benchmark [fuzz messages] [seconds] [seed]
+
+struct Frame {
+  std::string bytes;
+  bool dropped = false;  // by gen_msg, see above
+};
+
+static std::mt19937 rng;
+
+static std::string random_bytes(size_t len) {
+  std::string ret(len, '\0');
+  for (auto &c : ret) c = rng();
+  return ret;
+}
+
+static Frame ubx_frame(uint16_t msg_type, std::string payload, bool dropped = false) {
+  std::string msg = "\xb5\x62"s;
+  msg.push_back(msg_type >> 8);
+  msg.push_back(msg_type & 0xff);
+  msg.push_back(payload.size() & 0xff);
+  msg.push_back(payload.size() >> 8);
+  return {ublox::ubx_add_checksum(msg + payload), dropped};
+}
+
+static Frame rxm_rawx(int num_meas) {
+  std::string payload = random_bytes(16 + num_meas * 32);
+  payload[11] = num_meas;
+  return ubx_frame(0x0215, payload);
+}
+
+static Frame rxm_sfrbx(uint8_t sv_id, int subframe_id, int num_words = 10) {
+  // a gps subframe: 10 words of 24 bits and 6 parity bits, with the telemetry preamble and the subframe id
+  std::string subframe = random_bytes(num_words * 3);
+  if (num_words > 1) {
+    subframe[0] = 0x8b;
+    subframe[5] = (subframe[5] & ~0x1c) | (subframe_id << 2);
+  }
+
+  std::string payload = random_bytes(8);
+  payload[0] = ubx_t::gnss_type_t::GNSS_TYPE_GPS;
+  payload[1] = sv_id;
+  payload[4] = num_words;
+  for (int i = 0; i < num_words; i++) {
+    uint32_t word = ((uint8_t)subframe[i * 3] << 16 | (uint8_t)subframe[i * 3 + 1] << 8 | (uint8_t)subframe[i * 3 + 2]) << 6 | (rng() & 0x3f);
+    payload += std::string((char *)&word, sizeof(word));
+  }
+  const bool dropped = num_words != 10 || subframe_id < 1 || subframe_id > 5;
+  return ubx_frame(0x0213, payload, dropped);
+}
+
+static Frame random_frame() {
+  static int last_subframe[4] = {};
+  switch (rng() % 10) {
+    case 0:
+      return ubx_frame(0x0107, random_bytes(92));
+    case 1:
+      return rxm_rawx(rng() % 40);
+    case 2: {
+      // mostly the subframes of an sv in order, so its ephemeris is completed
+      const int sv_id = rng() % 4;
+      int &subframe_id = last_subframe[sv_id];
+      subframe_id = rng() % 8 == 0 ? rng() % 5 + 1 : subframe_id % 5 + 1;
+      return rxm_sfrbx(sv_id, subframe_id);
+    }
+    case 3:
+      return ubx_frame(0x0a09, random_bytes(60));
+    case 4:
+      return ubx_frame(0x0a0b, random_bytes(28));
+    case 5: {
+      const uint16_t types[] = {0x0107, 0x0215, 0x0213, 0x0a09, 0x0a0b};
+      return ubx_frame(types[rng() % 5], random_bytes(rng() % 16), true);
+    }
+    case 6:
+      // more measurements than an int8_t counts
+      return rxm_rawx(128 + rng() % 128);
+    case 7: {
+      const int num_words = rng() % 16;
+      return rxm_sfrbx(rng() % 4, rng() % 5 + 1, num_words == 10 ? 11 : num_words);
+    }
+    case 8: {
+      const int bad_ids[] = {0, 6, 7};
+      return rxm_sfrbx(rng() % 4, bad_ids[rng() % 3]);
+    }
+    default:
+      // a sfrbx of another constellation, which isn't decoded
+      std::string payload = random_bytes(8 + 10 * 4);
+      payload[0] = ubx_t::gnss_type_t::GNSS_TYPE_GLONASS;
+      payload[4] = 10;
+      return ubx_frame(0x0213, payload);
+  }
+}
+
+// the event without its logMonoTime, serialized the same way whatever buffer it was built in
+static kj::Array<capnp::word> comparable(kj::ArrayPtr<const capnp::word> words) {
+  capnp::FlatArrayMessageReader reader(words);
+  capnp::MallocMessageBuilder builder;
+  builder.setRoot(reader.getRoot<cereal::Event>());
+  builder.getRoot<cereal::Event>().setLogMonoTime(0);
+  return capnp::messageToFlatArray(builder);
+}
+
+static bool fuzz(int num_frames) {
+  std::vector<Frame> frames;
+  std::string stream;
+  int bad_preambles = 0;
+  for (int i = 0; i < num_frames; i++) {
+    frames.push_back(random_frame());
+    stream += frames.back().bytes;
+    if (rng() % 16 == 0) {
+      // a message whose preamble is broken, which neither parser may find. like garbage it can't
+      // have a preamble inside, which would hold the parser waiting for the length found after it
+      std::string bad = random_frame().bytes;
+      for (size_t j = 2; j < bad.size(); j++) if ((uint8_t)bad[j] == ublox::PREAMBLE1) bad[j] = 0;
+      bad[rng() % 2] ^= rng() % 255 + 1;
+      stream += bad;
+      bad_preambles++;
+    }
+    if (rng() % 4 == 0) {
+      // garbage between messages, without preamble so it can't start one
+      std::string garbage = random_bytes(rng() % 20);
+      for (auto &c : garbage) if ((uint8_t)c == ublox::PREAMBLE1) c = 0;
+      stream += garbage;
+    }
+  }
+
+  UbloxMsgParser parser, kaitai_parser;
+  int decoded = 0, events = 0, mismatches = 0;
+  size_t pos = 0;
+  while (pos < stream.size()) {
+    const size_t chunk = std::min<size_t>(rng() % 300 + 1, stream.size() - pos);
+    const uint8_t *data = (const uint8_t *)stream.data() + pos;
+    size_t consumed = 0;
+    while (consumed < chunk) {
+      size_t consumed_this_time = 0, consumed_kaitai = 0;
+      const bool valid = parser.add_data(data + consumed, chunk - consumed, consumed_this_time);
+      const bool valid_kaitai = kaitai_parser.add_data(data + consumed, chunk - consumed, consumed_kaitai);
+      if (valid != valid_kaitai || consumed_this_time != consumed_kaitai) {
+        printf("parsers out of sync at byte %zu\n", pos + consumed);
+        return false;
+      }
+      consumed += consumed_this_time;
+      if (!valid) continue;
+      if (decoded == frames.size()) {
+        printf("message decoded from garbage at byte %zu\n", pos + consumed);
+        return false;
+      }
+
+      const Frame &frame = frames[decoded++];
+      auto [service, bytes] = parser.gen_msg();
+      if (frame.dropped) {
+        mismatches += bytes.size() > 0;
+      } else {
+        std::pair<std::string, kj::Array<capnp::word>> expected;
+        try {
+          expected = kaitai_parser.gen_msg_kaitai();
+        } catch (const std::exception &) {
+          // no event, which gen_msg must agree with
+        }
+        bool same = (bytes.size() > 0) == (expected.second.size() > 0);
+        if (same && bytes.size() > 0) {
+          auto words = kj::arrayPtr((const capnp::word *)bytes.begin(), bytes.size() / sizeof(capnp::word));
+          same = service == expected.first && comparable(words).asBytes() == comparable(expected.second).asBytes();
+          events++;
+        }
+        mismatches += !same;
+        if (!same) printf("mismatch on message %d of type %02x%02x\n", decoded - 1, (uint8_t)frame.bytes[2], (uint8_t)frame.bytes[3]);
+      }
+      parser.reset();
+      kaitai_parser.reset();
+    }
+    pos += chunk;
+  }
+
+  printf("fuzz: %d messages and %d with a bad preamble, %d of %d decoded, %d events compared, %d mismatches\n",
+         num_frames, bad_preambles, decoded, (int)frames.size(), events, mismatches);
+  return decoded == frames.size() && mismatches == 0;
+}
+
+template <typename F>
+static void bench(const char *name, const std::string &stream, int frames_per_stream, double seconds, F &gen_msg) {
+  benchmark::Stage s = {.name = name, .unit = "events"};
+  const uint64_t start = nanos_since_boot();
+  while (nanos_since_boot() - start < seconds * 1e9) {
+    benchmark::measure(s, [&]() {
+      const uint8_t *data = (const uint8_t *)stream.data();
+      uint64_t events = 0;
+      size_t consumed = 0;
+      while (consumed < stream.size()) {
+        size_t consumed_this_time = 0;
+        if (gen_msg.parser.add_data(data + consumed, stream.size() - consumed, consumed_this_time)) {
+          events += gen_msg();
+          gen_msg.parser.reset();
+        }
+        consumed += consumed_this_time;
+      }
+      return events;
+    });
+  }
+  const double elapsed = s.total_ns() / 1e9;
+  const uint64_t msgs = s.ns.size() * frames_per_stream;
+  printf("  %-8s %9.0f msgs/s  %7.1f MB/s  %7.0f ns/msg  %6.2f allocs/msg  %lu %s\n", s.name, msgs / elapsed,
+         s.ns.size() * stream.size() / elapsed / 1e6, elapsed * 1e9 / msgs, (double)s.allocs / msgs, s.count, s.unit);
+}
+
+int main(int argc, char *argv[]) {
+  const int num_fuzz = argc > 1 ? atoi(argv[1]) : 100000;
+  const double seconds = argc > 2 ? atof(argv[2]) : 5;
+  rng.seed(argc > 3 ? atoi(argv[3]) : 0);
+
+  const bool ok = fuzz(num_fuzz);
+
+  // a second of a receiver at 10hz: pvt, rawx of 30 measurements and a gps subframe per epoch, hw status once
+  std::string stream;
+  int frames_per_stream = 0;
+  for (int i = 0; i < 10; i++) {
+    stream += ubx_frame(0x0107, random_bytes(92)).bytes;
+    stream += rxm_rawx(30).bytes;
+    stream += rxm_sfrbx(i % 2, i % 5 + 1).bytes;
+    frames_per_stream += 3;
+  }
+  stream += ubx_frame(0x0a09, random_bytes(60)).bytes;
+  stream += ubx_frame(0x0a0b, random_bytes(28)).bytes;
+  frames_per_stream += 2;
+
+  struct {
+    UbloxMsgParser parser;
+    bool operator()() { return parser.gen_msg().second.size() > 0; }
+  } direct;
+  struct {
+    UbloxMsgParser parser;
+    bool operator()() { return parser.gen_msg_kaitai().second.size() > 0; }
+  } kaitai;
+  printf("throughput, %zu byte stream of %d messages:\n", stream.size(), frames_per_stream);
+  bench("gen_msg", stream, frames_per_stream, seconds, direct);
+  bench("kaitai", stream, frames_per_stream, seconds, kaitai);
+  return ok ? 0 : 1;
+}
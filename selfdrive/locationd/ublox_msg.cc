@@ -7,7 +7,9 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <type_traits>
 #include <unordered_map>
 
 #include "selfdrive/common/swaglog.h"
@@ -19,6 +21,28 @@ inline static bool bit_to_bool(uint8_t val, int shifts) {
   return (bool)(val & (1 << shifts));
 }
 
+// ubx fields are little endian as the host, gps subframe fields are big endian
+template <typename T>
+inline static T read_le(const uint8_t *p) {
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+template <typename T>
+inline static T read_be(const uint8_t *p) {
+  std::make_unsigned_t<T> v = 0;
+  for (int i = 0; i < sizeof(T); i++) {
+    v = (v << 8) | p[i];
+  }
+  return (T)v;
+}
+
+// the bits wide two's complement value in the low bits of v
+inline static int32_t sign_extend(uint32_t v, int bits) {
+  return (int32_t)(v << (32 - bits)) >> (32 - bits);
+}
+
 inline int UbloxMsgParser::needed_bytes() {
   // Msg header incomplete?
   if(bytes_in_parse_buf < ublox::UBLOX_HEADER_SIZE)
@@ -93,7 +117,263 @@ bool UbloxMsgParser::add_data(const uint8_t *incoming_data, uint32_t incoming_da
 }
 
 
-std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
+std::pair<const char *, kj::ArrayPtr<capnp::byte>> UbloxMsgParser::gen_msg() {
+  const uint16_t msg_type = (msg_parse_buf[2] << 8) | msg_parse_buf[3];
+  const uint8_t *payload = msg_parse_buf + ublox::UBLOX_HEADER_SIZE;
+  const size_t len = UBLOX_MSG_SIZE(msg_parse_buf);
+
+  bool ret = false;
+  switch (msg_type) {
+  case 0x0107:
+    ret = parse_nav_pvt(payload, len);
+    break;
+  case 0x0213:
+    ret = parse_rxm_sfrbx(payload, len);
+    break;
+  case 0x0215:
+    ret = parse_rxm_rawx(payload, len);
+    break;
+  case 0x0a09:
+    ret = parse_mon_hw(payload, len);
+    break;
+  case 0x0a0b:
+    ret = parse_mon_hw2(payload, len);
+    break;
+  default:
+    LOGE("Unknown message type %x", msg_type);
+    break;
+  }
+
+  const char *service = msg_type == 0x0107 ? "gpsLocationExternal" : "ubloxGnss";
+  return {service, ret ? event.toBytes() : kj::ArrayPtr<capnp::byte>()};
+}
+
+bool UbloxMsgParser::parse_nav_pvt(const uint8_t *p, size_t len) {
+  if (len < 92) {
+    LOGE("Short NAV-PVT message %zu", len);
+    return false;
+  }
+
+  auto gpsLoc = event.initEvent().initGpsLocationExternal();
+  gpsLoc.setSource(cereal::GpsLocationData::SensorSource::UBLOX);
+  gpsLoc.setFlags(p[21]);
+  gpsLoc.setLatitude(read_le<int32_t>(p + 28) * 1e-07);
+  gpsLoc.setLongitude(read_le<int32_t>(p + 24) * 1e-07);
+  gpsLoc.setAltitude(read_le<int32_t>(p + 32) * 1e-03);
+  gpsLoc.setSpeed(read_le<int32_t>(p + 60) * 1e-03);
+  gpsLoc.setBearingDeg(read_le<int32_t>(p + 64) * 1e-5);
+  gpsLoc.setAccuracy(read_le<uint32_t>(p + 40) * 1e-03);
+  std::tm timeinfo = std::tm();
+  timeinfo.tm_year = read_le<uint16_t>(p + 4) - 1900;
+  timeinfo.tm_mon = p[6] - 1;
+  timeinfo.tm_mday = p[7];
+  timeinfo.tm_hour = p[8];
+  timeinfo.tm_min = p[9];
+  timeinfo.tm_sec = p[10];
+
+  std::time_t utc_tt = timegm(&timeinfo);
+  gpsLoc.setTimestamp(utc_tt * 1e+03 + read_le<int32_t>(p + 16) * 1e-06);
+  float f[] = { read_le<int32_t>(p + 48) * 1e-03f, read_le<int32_t>(p + 52) * 1e-03f, read_le<int32_t>(p + 56) * 1e-03f };
+  gpsLoc.setVNED(f);
+  gpsLoc.setVerticalAccuracy(read_le<uint32_t>(p + 44) * 1e-03);
+  gpsLoc.setSpeedAccuracy(read_le<int32_t>(p + 68) * 1e-03);
+  gpsLoc.setBearingAccuracyDeg(read_le<uint32_t>(p + 72) * 1e-05);
+  return true;
+}
+
+bool UbloxMsgParser::parse_rxm_sfrbx(const uint8_t *p, size_t len) {
+  if (len < 8 || len < 8 + p[4] * 4) {
+    LOGE("Short RXM-SFRBX message %zu", len);
+    return false;
+  }
+  // only gps ephemeris is decoded
+  if (p[0] != ubx_t::gnss_type_t::GNSS_TYPE_GPS || p[4] != 10) return false;
+
+  // GPS subframes are packed into 10x 4 bytes, each containing 3 actual bytes
+  uint8_t subframe_data[30];
+  for (int i = 0; i < 10; i++) {
+    uint32_t word = read_le<uint32_t>(p + 8 + i * 4) >> 6; // TODO: Verify parity
+    subframe_data[i * 3 + 0] = word >> 16;
+    subframe_data[i * 3 + 1] = word >> 8;
+    subframe_data[i * 3 + 2] = word >> 0;
+  }
+
+  // telemetry word preamble, then the subframe id in the handover word
+  if (subframe_data[0] != 0x8b) {
+    LOGE("Invalid GPS subframe preamble %02X", subframe_data[0]);
+    return false;
+  }
+  const int subframe_id = (subframe_data[5] >> 2) & 0x7;
+  if (subframe_id < 1 || subframe_id > 5) return false;
+
+  // Collect subframes and parse when we have all the parts
+  const uint8_t sv_id = p[1];
+  GpsSubframes &sv = gps_sv[sv_id];
+  if (subframe_id == 1) sv.received = 0;
+  sv.received |= 1 << subframe_id;
+  memcpy(sv.data[subframe_id], subframe_data, sizeof(subframe_data));
+  if (sv.received != 0x3e) return false;
+
+  auto eph = event.initEvent().initUbloxGnss().initEphemeris();
+  eph.setSvId(sv_id);
+
+  // Subframe 1
+  {
+    const uint8_t *s = sv.data[1];
+    eph.setGpsWeek((s[6] << 2) | (s[7] >> 6));
+    eph.setTgd((int8_t)s[20] * pow(2, -31));
+    eph.setToc(read_be<uint16_t>(s + 22) * pow(2, 4));
+    eph.setAf2((int8_t)s[24] * pow(2, -55));
+    eph.setAf1(read_be<int16_t>(s + 25) * pow(2, -43));
+    eph.setAf0(sign_extend(((s[27] << 16) | (s[28] << 8) | s[29]) >> 2, 22) * pow(2, -31));
+  }
+
+  // Subframe 2
+  {
+    const uint8_t *s = sv.data[2];
+    eph.setCrs(read_be<int16_t>(s + 7) * pow(2, -5));
+    eph.setDeltaN(read_be<int16_t>(s + 9) * pow(2, -43) * gpsPi);
+    eph.setM0(read_be<int32_t>(s + 11) * pow(2, -31) * gpsPi);
+    eph.setCuc(read_be<int16_t>(s + 15) * pow(2, -29));
+    eph.setEcc(read_be<int32_t>(s + 17) * pow(2, -33));
+    eph.setCus(read_be<int16_t>(s + 21) * pow(2, -29));
+    eph.setA(pow(read_be<uint32_t>(s + 23) * pow(2, -19), 2.0));
+    eph.setToe(read_be<uint16_t>(s + 27) * pow(2, 4));
+  }
+
+  // Subframe 3
+  {
+    const uint8_t *s = sv.data[3];
+    eph.setCic(read_be<int16_t>(s + 6) * pow(2, -29));
+    eph.setOmega0(read_be<int32_t>(s + 8) * pow(2, -31) * gpsPi);
+    eph.setCis(read_be<int16_t>(s + 12) * pow(2, -29));
+    eph.setI0(read_be<int32_t>(s + 14) * pow(2, -31) * gpsPi);
+    eph.setCrc(read_be<int16_t>(s + 18) * pow(2, -5));
+    eph.setOmega(read_be<int32_t>(s + 20) * pow(2, -31) * gpsPi);
+    eph.setOmegaDot(sign_extend((s[24] << 16) | (s[25] << 8) | s[26], 24) * pow(2, -43) * gpsPi);
+    eph.setIode(s[27]);
+    eph.setIDot(sign_extend(((s[28] << 8) | s[29]) >> 2, 14) * pow(2, -43) * gpsPi);
+  }
+
+  // Subframe 4
+  {
+    const uint8_t *s = sv.data[4];
+    const int data_id = s[6] >> 6, page_id = s[6] & 0x3f;
+
+    // This is page 18, why is the page id 56?
+    if (data_id == 1 && page_id == 56) {
+      const int8_t *iono = (const int8_t *)(s + 7);
+      double a0 = iono[0] * pow(2, -30);
+      double a1 = iono[1] * pow(2, -27);
+      double a2 = iono[2] * pow(2, -24);
+      double a3 = iono[3] * pow(2, -24);
+      eph.setIonoAlpha({a0, a1, a2, a3});
+
+      double b0 = iono[4] * pow(2, 11);
+      double b1 = iono[5] * pow(2, 14);
+      double b2 = iono[6] * pow(2, 16);
+      double b3 = iono[7] * pow(2, 16);
+      eph.setIonoBeta({b0, b1, b2, b3});
+    }
+  }
+  return true;
+}
+
+bool UbloxMsgParser::parse_rxm_rawx(const uint8_t *p, size_t len) {
+  const int num_meas = len < 16 ? 0 : p[11];
+  if (len < 16 || len < 16 + num_meas * 32) {
+    LOGE("Short RXM-RAWX message %zu", len);
+    return false;
+  }
+
+  auto mr = event.initEvent().initUbloxGnss().initMeasurementReport();
+  mr.setRcvTow(read_le<double>(p));
+  mr.setGpsWeek(read_le<uint16_t>(p + 8));
+  mr.setLeapSeconds((int8_t)p[10]);
+
+  auto mb = mr.initMeasurements(num_meas);
+  for (int i = 0; i < num_meas; i++) {
+    const uint8_t *m = p + 16 + i * 32;
+    mb[i].setSvId(m[21]);
+    mb[i].setPseudorange(read_le<double>(m));
+    mb[i].setCarrierCycles(read_le<double>(m + 8));
+    mb[i].setDoppler(read_le<float>(m + 16));
+    mb[i].setGnssId(m[20]);
+    mb[i].setGlonassFrequencyIndex(m[23]);
+    mb[i].setLocktime(read_le<uint16_t>(m + 24));
+    mb[i].setCno(m[26]);
+    mb[i].setPseudorangeStdev(0.01 * (pow(2, (m[27] & 15)))); // weird scaling, might be wrong
+    mb[i].setCarrierPhaseStdev(0.004 * (m[28] & 15));
+    mb[i].setDopplerStdev(0.002 * (pow(2, (m[29] & 15)))); // weird scaling, might be wrong
+
+    auto ts = mb[i].initTrackingStatus();
+    const uint8_t trk_stat = m[30];
+    ts.setPseudorangeValid(bit_to_bool(trk_stat, 0));
+    ts.setCarrierPhaseValid(bit_to_bool(trk_stat, 1));
+    ts.setHalfCycleValid(bit_to_bool(trk_stat, 2));
+    ts.setHalfCycleSubtracted(bit_to_bool(trk_stat, 3));
+  }
+
+  mr.setNumMeas(num_meas);
+  auto rs = mr.initReceiverStatus();
+  rs.setLeapSecValid(bit_to_bool(p[12], 0));
+  rs.setClkReset(bit_to_bool(p[12], 2));
+  return true;
+}
+
+bool UbloxMsgParser::parse_mon_hw(const uint8_t *p, size_t len) {
+  if (len < 60) {
+    LOGE("Short MON-HW message %zu", len);
+    return false;
+  }
+
+  auto hwStatus = event.initEvent().initUbloxGnss().initHwStatus();
+  hwStatus.setNoisePerMS(read_le<uint16_t>(p + 16));
+  hwStatus.setFlags(p[22]);
+  hwStatus.setAgcCnt(read_le<uint16_t>(p + 18));
+  hwStatus.setAStatus((cereal::UbloxGnss::HwStatus::AntennaSupervisorState) p[20]);
+  hwStatus.setAPower((cereal::UbloxGnss::HwStatus::AntennaPowerStatus) p[21]);
+  hwStatus.setJamInd(p[45]);
+  return true;
+}
+
+bool UbloxMsgParser::parse_mon_hw2(const uint8_t *p, size_t len) {
+  if (len < 28) {
+    LOGE("Short MON-HW2 message %zu", len);
+    return false;
+  }
+
+  auto hwStatus = event.initEvent().initUbloxGnss().initHwStatus2();
+  hwStatus.setOfsI((int8_t)p[0]);
+  hwStatus.setMagI(p[1]);
+  hwStatus.setOfsQ((int8_t)p[2]);
+  hwStatus.setMagQ(p[3]);
+
+  switch (p[4]) {
+    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_ROM:
+      hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::ROM);
+      break;
+    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_OTP:
+      hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::OTP);
+      break;
+    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_CONFIG_PINS:
+      hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::CONFIGPINS);
+      break;
+    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_FLASH:
+      hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::FLASH);
+      break;
+    default:
+      hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::UNDEFINED);
+      break;
+  }
+
+  hwStatus.setLowLevCfg(read_le<uint32_t>(p + 8));
+  hwStatus.setPostStatus(read_le<uint32_t>(p + 20));
+  return true;
+}
+
+
+std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg_kaitai() {
   std::string dat = data();
   kaitai::kstream stream(dat);
 
@@ -272,7 +552,7 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
 
   auto mb = mr.initMeasurements(msg->num_meas());
   auto measurements = *msg->measurements();
-  for(int8_t i = 0; i < msg->num_meas(); i++) {
+  for(int i = 0; i < msg->num_meas(); i++) {
     mb[i].setSvId(measurements[i]->sv_id());
     mb[i].setPseudorange(measurements[i]->pr_mes());
     mb[i].setCarrierCycles(measurements[i]->cp_mes());
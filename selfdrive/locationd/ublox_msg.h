@@ -23,6 +23,9 @@ namespace ublox {
   const int UBLOX_CHECKSUM_SIZE = 2;
   const int UBLOX_MAX_MSG_SIZE = 65536;
 
+  // the buffer gen_msg builds events in, a rawx of 255 measurements fits. larger events are flattened
+  const int UBLOX_EVENT_WORDS = 4096;
+
   struct ubx_mga_ini_time_utc_t {
     uint8_t type;
     uint8_t version;
@@ -90,7 +93,13 @@ class UbloxMsgParser {
     inline int needed_bytes();
     inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
 
-    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
+    // decodes the message in the parse buffer into a capnp event built in a reused buffer, without
+    // allocating. returns the service and the event, no bytes if there's nothing to publish.
+    // the bytes are valid until the next call
+    std::pair<const char *, kj::ArrayPtr<capnp::byte>> gen_msg();
+
+    // the same through the kaitai generated parser, the reference for ublox_benchmark
+    std::pair<std::string, kj::Array<capnp::word>> gen_msg_kaitai();
     kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
     kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
     kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
@@ -102,8 +111,23 @@ class UbloxMsgParser {
     inline bool valid();
     inline bool valid_so_far();
 
+    bool parse_nav_pvt(const uint8_t *p, size_t len);
+    bool parse_rxm_sfrbx(const uint8_t *p, size_t len);
+    bool parse_rxm_rawx(const uint8_t *p, size_t len);
+    bool parse_mon_hw(const uint8_t *p, size_t len);
+    bool parse_mon_hw2(const uint8_t *p, size_t len);
+
     std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
 
+    // gps subframes 1-5 of every sv for gen_msg, a bit in received for each one since subframe 1
+    struct GpsSubframes {
+      uint8_t received = 0;
+      uint8_t data[6][30];
+    };
+    GpsSubframes gps_sv[256];
+
+    ReusableMessageBuilder event{ublox::UBLOX_EVENT_WORDS};
+
     size_t bytes_in_parse_buf = 0;
     uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE];
 
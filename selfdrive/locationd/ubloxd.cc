@@ -32,7 +32,7 @@ int main() {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+    capnp::FlatArrayMessageReader cmsg(message_words(aligned_buf, msg.get()));
     cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
     auto ubloxRaw = event.getUbloxRaw();
 
@@ -45,10 +45,9 @@ int main() {
       if(parser.add_data(data + bytes_consumed, (uint32_t)(len - bytes_consumed), bytes_consumed_this_time)) {
 
         try {
-          auto ublox_msg = parser.gen_msg();
-          if (ublox_msg.second.size() > 0) {
-            auto bytes = ublox_msg.second.asBytes();
-            pm.send(ublox_msg.first.c_str(), bytes.begin(), bytes.size());
+          auto [service, bytes] = parser.gen_msg();
+          if (bytes.size() > 0) {
+            pm.send(service, bytes.begin(), bytes.size());
           }
         } catch (const std::exception& e) {
           LOGE("Error parsing ublox message %s", e.what());
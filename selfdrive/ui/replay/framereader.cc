@@ -1,9 +1,18 @@
 #include "selfdrive/ui/replay/framereader.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include "libyuv.h"
 
 #include "cereal/visionipc/visionbuf.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/util.h"
 
 namespace {
 
@@ -35,16 +44,116 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
+// Table 7-1
+enum HevcNalType {
+  HEVC_NAL_TYPE_RSV_VCL_N10 = 10,
+  HEVC_NAL_TYPE_BLA_W_LP = 16,
+  HEVC_NAL_TYPE_RSV_IRAP_VCL23 = 23,
+  HEVC_NAL_TYPE_VPS_NUT = 32,
+  HEVC_NAL_TYPE_PPS_NUT = 34,
+  HEVC_NAL_TYPE_AUD_NUT = 35,
+  HEVC_NAL_TYPE_PREFIX_SEI_NUT = 39,
+};
+
+size_t nextStartCode(const uint8_t *data, size_t size, size_t pos) {
+  for (; pos + 3 <= size; ++pos) {
+    if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) return pos;
+  }
+  return size;
+}
+
 }  // namespace
 
-FrameReader::FrameReader() {}
+// class HevcIndex
+
+bool HevcIndex::build(const uint8_t *data, size_t size) {
+  frames.clear();
+  prefix.clear();
+  file_size = size;
+
+  // a frame starts at the first prefix NAL (parameter sets, AUD, SEI) in front of its first slice
+  size_t au_start = std::string::npos;
+  for (size_t pos = nextStartCode(data, size, 0); pos + 6 <= size;) {
+    const size_t next = nextStartCode(data, size, pos + 3);
+    const int nal_type = (data[pos + 3] >> 1) & 0x3f;
+    if (nal_type < HEVC_NAL_TYPE_RSV_VCL_N10 || (nal_type >= HEVC_NAL_TYPE_BLA_W_LP && nal_type <= HEVC_NAL_TYPE_RSV_IRAP_VCL23)) {
+      // first_slice_segment_in_pic_flag
+      if (data[pos + 5] & 0x80) {
+        frames.push_back({(uint32_t)(au_start != std::string::npos ? au_start : pos), nal_type >= HEVC_NAL_TYPE_BLA_W_LP});
+      }
+      au_start = std::string::npos;
+    } else {
+      if (nal_type >= HEVC_NAL_TYPE_VPS_NUT && nal_type <= HEVC_NAL_TYPE_PPS_NUT && frames.empty()) {
+        prefix.append((const char *)data + pos, next - pos);
+      }
+      if (au_start == std::string::npos && ((nal_type >= HEVC_NAL_TYPE_VPS_NUT && nal_type <= HEVC_NAL_TYPE_AUD_NUT) || nal_type == HEVC_NAL_TYPE_PREFIX_SEI_NUT)) {
+        au_start = pos;
+      }
+    }
+    pos = next;
+  }
+  return !frames.empty();
+}
+
+bool HevcIndex::load(const std::string &file) {
+  std::string data = util::read_file(file);
+  if (data.size() < sizeof(uint32_t) * 3) return false;
+
+  uint32_t header[3];  // frame count, file size, prefix size
+  memcpy(header, data.data(), sizeof(header));
+  const size_t frames_size = header[0] * sizeof(uint32_t) * 2;
+  if (data.size() != sizeof(header) + header[2] + frames_size) return false;
+
+  file_size = header[1];
+  prefix = data.substr(sizeof(header), header[2]);
+  frames.resize(header[0]);
+  const uint32_t *p = (const uint32_t *)(data.data() + sizeof(header) + header[2]);
+  for (int i = 0; i < frames.size(); ++i) {
+    frames[i].offset = *p++;
+    frames[i].key = *p++;
+    // frameEnd(i) - offset is the size of a frame, a corrupt index mustn't make it wrap
+    if ((i > 0 && frames[i].offset <= frames[i - 1].offset) || frames[i].offset >= file_size) {
+      frames.clear();
+      return false;
+    }
+  }
+  return !frames.empty();
+}
+
+bool HevcIndex::save(const std::string &file) const {
+  std::ofstream fs(file, std::ios::binary | std::ios::out);
+  const uint32_t header[3] = {(uint32_t)frames.size(), (uint32_t)file_size, (uint32_t)prefix.size()};
+  fs.write((const char *)header, sizeof(header));
+  fs.write(prefix.data(), prefix.size());
+  for (const auto &f : frames) {
+    const uint32_t entry[2] = {f.offset, f.key};
+    fs.write((const char *)entry, sizeof(entry));
+  }
+  return fs.good();
+}
+
+// class FrameReader
+
+FrameReader::FrameReader(size_t cache_bytes, int lookahead, int decoders)
+    : cache_bytes_(cache_bytes), lookahead_(lookahead),
+      max_decoders_(decoders > 0 ? decoders : std::clamp<int>(std::thread::hardware_concurrency() / 2, 1, MAX_SW_DECODERS)) {}
 
 FrameReader::~FrameReader() {
+  {
+    std::unique_lock lk(cache_lock_);
+    exit_ = true;
+  }
+  prefetch_cv_.notify_all();
+  for (auto &t : prefetch_threads_) {
+    t.join();
+  }
+
   for (AVPacket *pkt : packets) {
     av_packet_free(&pkt);
   }
+  if (fd_ >= 0) close(fd_);
 
-  if (decoder_ctx) avcodec_free_context(&decoder_ctx);
+  decoders_.clear();
   if (input_ctx) avformat_close_input(&input_ctx);
   if (hw_device_ctx) av_buffer_unref(&hw_device_ctx);
 
@@ -55,13 +164,122 @@ FrameReader::~FrameReader() {
 }
 
 bool FrameReader::load(const std::string &url, bool no_cuda, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  const std::string file = getUrlWithoutQuery(url);
+  const bool is_hevc = file.size() > 5 && file.compare(file.size() - 5, 5, ".hevc") == 0;
+  if (is_hevc && openIndexedSource(url, local_cache, retries)) {
+    return loadIndexed(no_cuda, abort);
+  }
+
   FileReader f(local_cache, chunk_size, retries);
   std::string data = f.read(url, abort);
   if (data.empty()) return false;
 
+  if (is_hevc && local_cache && url.find("https://") == 0) {
+    // index the downloaded stream, next time only the requested GOPs are fetched
+    HevcIndex index;
+    if (index.build((const uint8_t *)data.data(), data.size())) {
+      index.save(cacheFilePath(url) + ".idx");
+    }
+  }
   return load((std::byte *)data.data(), data.size(), no_cuda, abort);
 }
 
+bool FrameReader::openIndexedSource(const std::string &url, bool local_cache, int retries) {
+  const bool is_remote = url.find("https://") == 0;
+  const std::string local_file = is_remote ? cacheFilePath(url) : url;
+
+  if ((!is_remote || local_cache) && util::file_exists(local_file)) {
+    fd_ = HANDLE_EINTR(open(local_file.c_str(), O_RDONLY));
+    if (fd_ < 0) return false;
+
+    const off_t size = lseek(fd_, 0, SEEK_END);
+    void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0) : MAP_FAILED;
+    if (data == MAP_FAILED) return false;
+
+    const bool indexed = index_.build((const uint8_t *)data, size);
+    munmap(data, size);
+    if (!indexed) return false;
+
+    read_range_ = [this](size_t offset, size_t size, std::string &buf) {
+      buf.resize(size);
+      for (size_t n = 0; n < size;) {
+        ssize_t bytes = HANDLE_EINTR(pread(fd_, buf.data() + n, size - n, offset + n));
+        if (bytes <= 0) return false;
+        n += bytes;
+      }
+      return true;
+    };
+    return true;
+  } else if (is_remote && index_.load(cacheFilePath(url) + ".idx")) {
+    read_range_ = [=](size_t offset, size_t size, std::string &buf) {
+      for (int i = 0; i <= retries; ++i) {
+        buf = httpGetRange(url, offset, size);
+        if (buf.size() == size) return true;
+      }
+      return false;
+    };
+    return true;
+  }
+  return false;
+}
+
+bool FrameReader::loadIndexed(bool no_cuda, std::atomic<bool> *abort) {
+  // probe the stream and open the decoders with the first GOP.
+  auto second_key = std::find_if(index_.frames.begin() + 1, index_.frames.end(), [](auto &f) { return f.key; });
+  std::string first_gop;
+  if (!read_range_(0, index_.frameEnd(second_key - index_.frames.begin() - 1), first_gop) ||
+      !load((std::byte *)first_gop.data(), first_gop.size(), no_cuda, abort)) {
+    return false;
+  }
+
+  // the remaining GOPs are fetched on demand
+  for (AVPacket *pkt : packets) {
+    av_packet_free(&pkt);
+  }
+  packets.assign(index_.frames.size(), nullptr);
+  key_frames_.clear();
+  for (int i = 0; i < index_.frames.size(); ++i) {
+    if (index_.frames[i].key) key_frames_.push_back(i);
+  }
+  return valid_;
+}
+
+AVPacket *FrameReader::packet(int idx) {
+  std::lock_guard lk(fetch_lock_);
+  if (!packets[idx] && read_range_) {
+    // fetch the whole GOP with a single read
+    const int begin = key_frames_.size() > 1 ? std::max(keyFrameBefore(idx), 0) : 0;
+    auto next_key = std::upper_bound(key_frames_.begin(), key_frames_.end(), idx);
+    const int end = (key_frames_.size() > 1 && next_key != key_frames_.end()) ? *next_key : packets.size();
+    const size_t offset = index_.frames[begin].offset;
+    std::string buf;
+    if (!read_range_(offset, index_.frameEnd(end - 1) - offset, buf)) {
+      printf("failed to fetch frames %d-%d\n", begin, end - 1);
+      return nullptr;
+    }
+
+    for (int i = begin; i < end; ++i) {
+      if (packets[i]) continue;
+
+      const auto &f = index_.frames[i];
+      const size_t size = index_.frameEnd(i) - f.offset;
+      // key frames in the middle of the stream may rely on the parameter sets at its beginning
+      const bool add_prefix = f.key && f.offset > 0;
+      AVPacket *pkt = av_packet_alloc();
+      av_new_packet(pkt, size + (add_prefix ? index_.prefix.size() : 0));
+      uint8_t *dst = pkt->data;
+      if (add_prefix) {
+        memcpy(dst, index_.prefix.data(), index_.prefix.size());
+        dst += index_.prefix.size();
+      }
+      memcpy(dst, buf.data() + (f.offset - offset), size);
+      if (f.key) pkt->flags |= AV_PKT_FLAG_KEY;
+      packets[i] = pkt;
+    }
+  }
+  return packets[idx];
+}
+
 bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::atomic<bool> *abort) {
   input_ctx = avformat_alloc_context();
   if (!input_ctx) return false;
@@ -95,24 +313,37 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::at
   AVCodec *decoder = avcodec_find_decoder(video->codec->codec_id);
   if (!decoder) return false;
 
-  decoder_ctx = avcodec_alloc_context3(decoder);
-  ret = avcodec_parameters_to_context(decoder_ctx, video->codecpar);
-  if (ret != 0) return false;
-
-  width = (decoder_ctx->width + 3) & ~3;
-  height = decoder_ctx->height;
-  visionbuf_compute_aligned_width_and_height(width, height, &aligned_width, &aligned_height);
-
-  if (has_cuda_device && !no_cuda) {
-    if (!initHardwareDecoder(AV_HWDEVICE_TYPE_CUDA)) {
-      printf("No CUDA capable device was found. fallback to CPU decoding.\n");
-    } else {
-      nv12toyuv_buffer.resize(getYUVSize());
+  // one hardware decoder, or a pool of software decoders to decode GOPs in parallel.
+  bool use_hw = false;
+  for (int i = 0; i < (use_hw ? 1 : max_decoders_); ++i) {
+    auto d = std::make_unique<DecoderContext>();
+    d->ctx = avcodec_alloc_context3(decoder);
+    ret = avcodec_parameters_to_context(d->ctx, video->codecpar);
+    if (ret != 0) return false;
+
+    if (i == 0) {
+      width = (d->ctx->width + 3) & ~3;
+      height = d->ctx->height;
+      visionbuf_compute_aligned_width_and_height(width, height, &aligned_width, &aligned_height);
+
+      if (has_cuda_device && !no_cuda) {
+        use_hw = initHardwareDecoder(d->ctx, AV_HWDEVICE_TYPE_CUDA);
+        if (!use_hw) {
+          printf("No CUDA capable device was found. fallback to CPU decoding.\n");
+        }
+      }
+    }
+    if (!use_hw) {
+      // frame threading delays the output by thread_count frames, which breaks the
+      // one packet in, one frame out decoding in decodeFrame. use slice threading only.
+      d->ctx->thread_count = 0;
+      d->ctx->thread_type = FF_THREAD_SLICE;
     }
-  }
 
-  ret = avcodec_open2(decoder_ctx, decoder, nullptr);
-  if (ret < 0) return false;
+    ret = avcodec_open2(d->ctx, decoder, nullptr);
+    if (ret < 0) return false;
+    decoders_.push_back(std::move(d));
+  }
 
   packets.reserve(60 * 20);  // 20fps, one minute
   while (!(abort && *abort)) {
@@ -123,20 +354,22 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::at
       valid_ = (ret == AVERROR_EOF);
       break;
     }
-    packets.push_back(pkt);
     // some stream seems to contian no keyframes
-    key_frames_count_ += pkt->flags & AV_PKT_FLAG_KEY;
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      key_frames_.push_back(packets.size());
+    }
+    packets.push_back(pkt);
   }
   valid_ = valid_ && !packets.empty();
   return valid_;
 }
 
-bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
+bool FrameReader::initHardwareDecoder(AVCodecContext *ctx, AVHWDeviceType hw_device_type) {
   for (int i = 0;; i++) {
-    const AVCodecHWConfig *config = avcodec_get_hw_config(decoder_ctx->codec, i);
+    const AVCodecHWConfig *config = avcodec_get_hw_config(ctx->codec, i);
     if (!config) {
       printf("decoder %s does not support hw device type %s.\n",
-             decoder_ctx->codec->name, av_hwdevice_get_type_name(hw_device_type));
+             ctx->codec->name, av_hwdevice_get_type_name(hw_device_type));
       return false;
     }
     if (config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX && config->device_type == hw_device_type) {
@@ -153,9 +386,9 @@ bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
     return false;
   }
 
-  decoder_ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-  decoder_ctx->opaque = &hw_pix_fmt;
-  decoder_ctx->get_format = get_hw_format;
+  ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+  ctx->opaque = &hw_pix_fmt;
+  ctx->get_format = get_hw_format;
   return true;
 }
 
@@ -164,78 +397,287 @@ bool FrameReader::get(int idx, uint8_t *rgb, uint8_t *yuv) {
   if (!valid_ || idx < 0 || idx >= packets.size()) {
     return false;
   }
-  return decode(idx, rgb, yuv);
+
+  std::unique_lock lk(cache_lock_);
+  cursor_ = idx;
+  if (lookahead_ > 0 && prefetch_threads_.empty()) {
+    for (int i = 0; i < decoders_.size(); ++i) {
+      prefetch_threads_.emplace_back(&FrameReader::prefetchThread, this);
+    }
+  }
+  bool ret = false;
+  auto it = cache_.find(idx);
+  if (it != cache_.end()) {
+    ++stats_.hits;
+    ret = copyBuffers(it->second.data(), rgb, yuv);
+  } else {
+    ++stats_.misses;
+    lk.unlock();
+    prefetch_cv_.notify_all();
+    ret = decode(idx, rgb, yuv);
+    lk.lock();
+  }
+  if (idx == packets.size() - 1) {
+    // nothing is ahead of the last frame, don't keep the frames of a finished segment resident
+    cache_.clear();
+    free_bufs_.clear();
+  }
+  prefetch_cv_.notify_all();
+  return ret;
+}
+
+bool FrameReader::decodeRange(int from, int to, const std::function<void(int, const uint8_t *)> &callback) {
+  from = std::max(from, 0);
+  to = std::min<int>(to, packets.size() - 1);
+  if (!valid_ || from > to) return false;
+
+  // split the range into GOPs. without key frames the whole range is decoded by one decoder.
+  std::vector<std::pair<int, int>> gops;
+  for (int start = from; start <= to;) {
+    auto next_key = std::upper_bound(key_frames_.begin(), key_frames_.end(), start);
+    int end = (key_frames_.size() > 1 && next_key != key_frames_.end()) ? std::min(*next_key - 1, to) : to;
+    gops.push_back({start, end});
+    start = end + 1;
+  }
+
+  std::atomic<int> next_gop = 0;
+  std::atomic<bool> success = true;
+  auto worker = [&](DecoderContext *d) {
+    std::lock_guard lk(d->lock);
+    std::vector<uint8_t> buf(getYUVSize());
+    for (int n = next_gop++; n < gops.size(); n = next_gop++) {
+      auto [start, end] = gops[n];
+      const int key_frame = keyFrameBefore(start);
+      int i = start;
+      if (d->prev_idx < start && d->prev_idx >= key_frame) {
+        i = d->prev_idx + 1;
+      } else if (key_frames_.size() > 1 && key_frame >= 0) {
+        i = key_frame;
+      }
+      d->prev_idx = end;
+      for (; i <= end; ++i) {
+        const double start_ts = millis_since_boot();
+        AVFrame *f = decodeFrame(d, packet(i));
+        const double decode_ms = millis_since_boot() - start_ts;
+        {
+          std::unique_lock cache_lk(cache_lock_);
+          ++stats_.decoded_frames;
+          stats_.decode_ms += decode_ms;
+        }
+        if (i >= start) {
+          if (!f) {
+            success = false;
+            continue;
+          }
+          toI420(f, buf.data());
+          callback(i, buf.data());
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < std::min(decoders_.size(), gops.size()); ++i) {
+    threads.emplace_back(worker, decoders_[i].get());
+  }
+  worker(decoders_[0].get());
+  for (auto &t : threads) t.join();
+  return success;
+}
+
+FrameCacheStats FrameReader::cacheStats() const {
+  std::unique_lock lk(cache_lock_);
+  return stats_;
+}
+
+int FrameReader::keyFrameBefore(int idx) const {
+  auto it = std::upper_bound(key_frames_.begin(), key_frames_.end(), idx);
+  return it == key_frames_.begin() ? -1 : *std::prev(it);
+}
+
+void FrameReader::prefetchThread() {
+  std::unique_lock lk(cache_lock_);
+  while (true) {
+    int next = -1;
+    prefetch_cv_.wait(lk, [&]() {
+      if (exit_) return true;
+      // each prefetch thread works on a different GOP of the look-ahead window
+      const int last = std::min<int>(cursor_ + lookahead_, packets.size() - 1);
+      for (int i = cursor_ + 1; i <= last; ++i) {
+        if (cache_.find(i) == cache_.end() && prefetching_gops_.count(keyFrameBefore(i)) == 0) {
+          next = i;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (exit_) break;
+
+    const int cursor = cursor_;
+    const int gop = keyFrameBefore(next);
+    prefetching_gops_.insert(gop);
+    lk.unlock();
+    bool success = decode(next);
+    lk.lock();
+    prefetching_gops_.erase(gop);
+    prefetch_cv_.notify_all();
+
+    if (!success) {
+      // don't retry the broken frame until the playback cursor moves
+      prefetch_cv_.wait(lk, [&]() { return exit_ || cursor_ != cursor; });
+    }
+  }
+}
+
+FrameReader::DecoderContext *FrameReader::acquireDecoder(int idx) {
+  // prefer the decoder that is already positioned in the GOP of idx, then an idle one.
+  const int key_frame = keyFrameBefore(idx);
+  for (auto &d : decoders_) {
+    const int prev_idx = d->prev_idx;
+    if (prev_idx < idx && prev_idx >= key_frame) {
+      d->lock.lock();
+      return d.get();
+    }
+  }
+  for (auto &d : decoders_) {
+    if (d->lock.try_lock()) return d.get();
+  }
+  auto &d = decoders_[std::max(key_frame, 0) % decoders_.size()];
+  d->lock.lock();
+  return d.get();
 }
 
 bool FrameReader::decode(int idx, uint8_t *rgb, uint8_t *yuv) {
+  DecoderContext *d = acquireDecoder(idx);
+  std::lock_guard lk(d->lock, std::adopt_lock);
+
   int from_idx = idx;
-  if (idx != prev_idx + 1 && key_frames_count_ > 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (packets[i]->flags & AV_PKT_FLAG_KEY) {
-        from_idx = i;
-        break;
-      }
+  if (idx != d->prev_idx + 1 && key_frames_.size() > 1) {
+    // continue from the current decoder position if it's in the same GOP,
+    // otherwise seek to the nearest key frame
+    const int key_frame = keyFrameBefore(idx);
+    if (d->prev_idx < idx && d->prev_idx >= key_frame) {
+      from_idx = d->prev_idx + 1;
+    } else if (key_frame >= 0) {
+      from_idx = key_frame;
     }
   }
-  prev_idx = idx;
+  d->prev_idx = idx;
 
   for (int i = from_idx; i <= idx; ++i) {
-    AVFrame *f = decodeFrame(packets[i]);
-    if (f && i == idx) {
-      return copyBuffers(f, rgb, yuv);
+    const double start_ts = millis_since_boot();
+    AVFrame *f = decodeFrame(d, packet(i));
+    const double decode_ms = millis_since_boot() - start_ts;
+    {
+      std::unique_lock cache_lk(cache_lock_);
+      ++stats_.decoded_frames;
+      stats_.decode_ms += decode_ms;
+    }
+    if (f) {
+      // frames decoded on the way to idx are cached too, for scrubbing within the GOP
+      const bool is_target = (i == idx);
+      cacheFrame(i, f, is_target ? rgb : nullptr, is_target ? yuv : nullptr);
+      if (is_target) return true;
     }
   }
   return false;
 }
 
-AVFrame *FrameReader::decodeFrame(AVPacket *pkt) {
-  int ret = avcodec_send_packet(decoder_ctx, pkt);
+AVFrame *FrameReader::decodeFrame(DecoderContext *d, AVPacket *pkt) {
+  if (!pkt) return nullptr;
+
+  int ret = avcodec_send_packet(d->ctx, pkt);
   if (ret < 0) {
     printf("Error sending a packet for decoding\n");
     return nullptr;
   }
 
-  av_frame_.reset(av_frame_alloc());
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_.get());
+  d->av_frame.reset(av_frame_alloc());
+  ret = avcodec_receive_frame(d->ctx, d->av_frame.get());
   if (ret != 0) {
     return nullptr;
   }
 
-  if (av_frame_->format == hw_pix_fmt) {
-    hw_frame.reset(av_frame_alloc());
-    if ((ret = av_hwframe_transfer_data(hw_frame.get(), av_frame_.get(), 0)) < 0) {
+  if (d->av_frame->format == hw_pix_fmt) {
+    d->hw_frame.reset(av_frame_alloc());
+    if ((ret = av_hwframe_transfer_data(d->hw_frame.get(), d->av_frame.get(), 0)) < 0) {
       printf("error transferring the data from GPU to CPU\n");
       return nullptr;
     }
-    return hw_frame.get();
+    return d->hw_frame.get();
   } else {
-    return av_frame_.get();
+    return d->av_frame.get();
   }
 }
 
-bool FrameReader::copyBuffers(AVFrame *f, uint8_t *rgb, uint8_t *yuv) {
+void FrameReader::toI420(AVFrame *f, uint8_t *buf) {
+  uint8_t *y = buf;
+  uint8_t *u = y + width * height;
+  uint8_t *v = u + (width / 2) * (height / 2);
   if (hw_pix_fmt == AV_PIX_FMT_CUDA) {
-    uint8_t *y = yuv ? yuv : nv12toyuv_buffer.data();
-    uint8_t *u = y + width * height;
-    uint8_t *v = u + (width / 2) * (height / 2);
     libyuv::NV12ToI420(f->data[0], f->linesize[0], f->data[1], f->linesize[1],
                        y, width, u, width / 2, v, width / 2, width, height);
-    libyuv::I420ToRGB24(y, width, u, width / 2, v, width / 2,
-                        rgb, aligned_width * 3, width, height);
   } else {
-    if (yuv) {
-      uint8_t *u = yuv + width * height;
-      uint8_t *v = u + (width / 2) * (height / 2);
-      libyuv::I420Copy(f->data[0], f->linesize[0],
-                       f->data[1], f->linesize[1],
-                       f->data[2], f->linesize[2],
-                       yuv, width, u, width / 2, v, width / 2,
-                       width, height);
-    }
-    libyuv::I420ToRGB24(f->data[0], f->linesize[0],
-                        f->data[1], f->linesize[1],
-                        f->data[2], f->linesize[2],
+    libyuv::I420Copy(f->data[0], f->linesize[0],
+                     f->data[1], f->linesize[1],
+                     f->data[2], f->linesize[2],
+                     y, width, u, width / 2, v, width / 2,
+                     width, height);
+  }
+}
+
+void FrameReader::cacheFrame(int idx, AVFrame *f, uint8_t *rgb, uint8_t *yuv) {
+  std::vector<uint8_t> buf;
+  {
+    std::unique_lock lk(cache_lock_);
+    if (!rgb && !yuv && cache_.find(idx) != cache_.end()) return;
+
+    if (!free_bufs_.empty()) {
+      buf = std::move(free_bufs_.back());
+      free_bufs_.pop_back();
+    }
+  }
+
+  buf.resize(getYUVSize());
+  toI420(f, buf.data());
+  if (rgb || yuv) {
+    copyBuffers(buf.data(), rgb, yuv);
+  }
+
+  std::unique_lock lk(cache_lock_);
+  if (cache_.find(idx) != cache_.end()) {
+    recycleBuffer(std::move(buf));
+    return;
+  }
+  const size_t cache_frames = std::max<size_t>(cache_bytes_ / getYUVSize(), lookahead_ + 1);
+  if (cache_.size() >= cache_frames) {
+    // GOP-aware eviction: drop the GOPs behind the playback cursor first,
+    // then the frames furthest ahead of the look-ahead window.
+    auto victim = cache_.begin();
+    if (victim->first >= keyFrameBefore(cursor_) && std::prev(cache_.end())->first > cursor_ + lookahead_) {
+      victim = std::prev(cache_.end());
+    }
+    recycleBuffer(std::move(victim->second));
+    cache_.erase(victim);
+  }
+  cache_[idx] = std::move(buf);
+}
+
+void FrameReader::recycleBuffer(std::vector<uint8_t> &&buf) {
+  // at most one spare buffer per decoder, cacheFrame takes one each time a frame is decoded
+  if (free_bufs_.size() < decoders_.size()) {
+    free_bufs_.push_back(std::move(buf));
+  }
+}
+
+bool FrameReader::copyBuffers(const uint8_t *i420, uint8_t *rgb, uint8_t *yuv) {
+  const uint8_t *u = i420 + width * height;
+  const uint8_t *v = u + (width / 2) * (height / 2);
+  if (yuv) {
+    memcpy(yuv, i420, getYUVSize());
+  }
+  if (rgb) {
+    libyuv::I420ToRGB24(i420, width, u, width / 2, v, width / 2,
                         rgb, aligned_width * 3, width, height);
   }
   return true;
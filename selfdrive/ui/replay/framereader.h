@@ -1,7 +1,13 @@
 #pragma once
 
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "selfdrive/ui/replay/filereader.h"
@@ -11,42 +17,115 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+// decoded frames are cached as I420. a fcamera frame is about 3.5M,
+// the cache always holds at least the look-ahead window.
+constexpr size_t FRAME_CACHE_BYTES = 48 * 1024 * 1024;
+constexpr int FRAME_LOOKAHEAD = 10;
+constexpr int MAX_SW_DECODERS = 4;
+
 struct AVFrameDeleter {
   void operator()(AVFrame* frame) const { av_frame_free(&frame); }
 };
 
+// byte ranges of the frames in a raw hevc stream, see tools/lib/vidindex.
+// lets FrameReader fetch and demux a single GOP instead of the whole file.
+struct HevcIndex {
+  struct Frame {
+    uint32_t offset;
+    bool key;
+  };
+  bool build(const uint8_t *data, size_t size);
+  bool load(const std::string &file);
+  bool save(const std::string &file) const;
+  inline size_t frameEnd(int idx) const { return idx + 1 < frames.size() ? frames[idx + 1].offset : file_size; }
+
+  std::vector<Frame> frames;
+  std::string prefix;  // VPS, SPS and PPS
+  size_t file_size = 0;
+};
+
+struct FrameCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t decoded_frames = 0;
+  double decode_ms = 0;  // total time spent in the decoder
+  inline double hitRate() const { return hits + misses > 0 ? (double)hits / (hits + misses) : 0; }
+  inline double avgDecodeMs() const { return decoded_frames > 0 ? decode_ms / decoded_frames : 0; }
+};
+
 class FrameReader {
 public:
-  FrameReader();
+  // decoders = 0 picks the number of software decoders from the available cores.
+  // with CUDA there is always a single hardware decoder.
+  FrameReader(size_t cache_bytes = FRAME_CACHE_BYTES, int lookahead = FRAME_LOOKAHEAD, int decoders = 0);
   ~FrameReader();
   bool load(const std::string &url, bool no_cuda = false, std::atomic<bool> *abort = nullptr, bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, bool no_cuda = false, std::atomic<bool> *abort = nullptr);
   bool get(int idx, uint8_t *rgb, uint8_t *yuv);
+  // decode frames [from, to] bypassing the cache, one GOP per decoder in parallel.
+  // callback is called from the decoding threads with the I420 frame, frames may arrive out of order.
+  bool decodeRange(int from, int to, const std::function<void(int idx, const uint8_t *yuv)> &callback);
   int getRGBSize() const { return aligned_width * aligned_height * 3; }
   int getYUVSize() const { return width * height * 3 / 2; }
   size_t getFrameCount() const { return packets.size(); }
+  size_t getDecoderCount() const { return decoders_.size(); }
   bool valid() const { return valid_; }
+  FrameCacheStats cacheStats() const;
 
   int width = 0, height = 0;
   int aligned_width = 0, aligned_height = 0;
 
 private:
-  bool initHardwareDecoder(AVHWDeviceType hw_device_type);
-  bool decode(int idx, uint8_t *rgb, uint8_t *yuv);
-  AVFrame * decodeFrame(AVPacket *pkt);
-  bool copyBuffers(AVFrame *f, uint8_t *rgb, uint8_t *yuv);
+  struct DecoderContext {
+    ~DecoderContext() { if (ctx) avcodec_free_context(&ctx); }
+    AVCodecContext *ctx = nullptr;
+    std::unique_ptr<AVFrame, AVFrameDeleter> av_frame, hw_frame;
+    std::atomic<int> prev_idx = -1;
+    std::mutex lock;
+  };
 
+  bool openIndexedSource(const std::string &url, bool local_cache, int retries);
+  bool loadIndexed(bool no_cuda, std::atomic<bool> *abort);
+  AVPacket *packet(int idx);
+  bool initHardwareDecoder(AVCodecContext *ctx, AVHWDeviceType hw_device_type);
+  DecoderContext *acquireDecoder(int idx);
+  bool decode(int idx, uint8_t *rgb = nullptr, uint8_t *yuv = nullptr);
+  AVFrame * decodeFrame(DecoderContext *d, AVPacket *pkt);
+  void toI420(AVFrame *f, uint8_t *buf);
+  void cacheFrame(int idx, AVFrame *f, uint8_t *rgb, uint8_t *yuv);
+  void recycleBuffer(std::vector<uint8_t> &&buf);
+  bool copyBuffers(const uint8_t *i420, uint8_t *rgb, uint8_t *yuv);
+  int keyFrameBefore(int idx) const;
+  void prefetchThread();
+
+  // with an indexed source, packets are fetched one GOP at a time on first use
   std::vector<AVPacket*> packets;
-  std::unique_ptr<AVFrame, AVFrameDeleter>av_frame_, hw_frame;
+  HevcIndex index_;
+  std::function<bool(size_t offset, size_t size, std::string &buf)> read_range_;
+  std::mutex fetch_lock_;
+  int fd_ = -1;
+  std::vector<int> key_frames_;
+  std::vector<std::unique_ptr<DecoderContext>> decoders_;
   AVFormatContext *input_ctx = nullptr;
-  AVCodecContext *decoder_ctx = nullptr;
-  int key_frames_count_ = 0;
   bool valid_ = false;
   AVIOContext *avio_ctx_ = nullptr;
 
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
-  std::vector<uint8_t> nv12toyuv_buffer;
-  int prev_idx = -1;
   inline static std::atomic<bool> has_cuda_device = true;
+
+  // decoded frame cache, keyed by frame index. a decoder's lock is always taken before cache_lock_.
+  // it is released once the last frame is served.
+  mutable std::mutex cache_lock_;
+  std::condition_variable prefetch_cv_;
+  std::map<int, std::vector<uint8_t>> cache_;
+  std::vector<std::vector<uint8_t>> free_bufs_;
+  std::set<int> prefetching_gops_;
+  const size_t cache_bytes_;
+  const int lookahead_;
+  const int max_decoders_;
+  int cursor_ = -1;
+  bool exit_ = false;
+  FrameCacheStats stats_;
+  std::vector<std::thread> prefetch_threads_;
 };
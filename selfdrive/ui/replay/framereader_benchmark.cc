@@ -0,0 +1,77 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libyuv.h"
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/ui/replay/framereader.h"
+
+// decode a whole camera file serially through get(), then GOP-parallel through decodeRange(), and report frames/s.
+// both produce the same output of every frame, a YUV copy and an RGB conversion, as get() does.
+// usage: framereader_benchmark <file or url> [decoders]
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <file or url> [decoders]\n", argv[0]);
+    return 1;
+  }
+  const std::string file = argv[1];
+  const int decoders = argc > 2 ? atoi(argv[2]) : 0;
+
+  FileReader f(true);
+  std::string data = f.read(file);
+  if (data.empty()) {
+    printf("failed to read %s\n", file.c_str());
+    return 1;
+  }
+
+  // serial: one software decoder, no cache and no look-ahead
+  {
+    FrameReader fr(0, 0, 1);
+    if (!fr.load((std::byte *)data.data(), data.size(), true)) {
+      printf("failed to load %s\n", file.c_str());
+      return 1;
+    }
+    auto rgb = std::make_unique<uint8_t[]>(fr.getRGBSize());
+    auto yuv = std::make_unique<uint8_t[]>(fr.getYUVSize());
+    const double start_ts = millis_since_boot();
+    size_t decoded = 0;
+    for (int i = 0; i < fr.getFrameCount(); ++i) {
+      decoded += fr.get(i, rgb.get(), yuv.get());
+    }
+    const double ms = millis_since_boot() - start_ts;
+    const FrameCacheStats stats = fr.cacheStats();
+    printf("serial:   %zu/%zu frames in %.1f ms, %.1f frames/s, cache hit rate %.1f%%, decode %.2f ms/frame\n", decoded,
+           fr.getFrameCount(), ms, decoded * 1000.0 / ms, stats.hitRate() * 100, stats.avgDecodeMs());
+  }
+
+  // parallel: one GOP per decoder
+  {
+    FrameReader fr(0, 0, decoders);
+    if (!fr.load((std::byte *)data.data(), data.size(), true)) {
+      printf("failed to load %s\n", file.c_str());
+      return 1;
+    }
+    std::atomic<size_t> decoded = 0;
+    const double start_ts = millis_since_boot();
+    fr.decodeRange(0, fr.getFrameCount() - 1, [&](int idx, const uint8_t *i420) {
+      thread_local std::vector<uint8_t> rgb, yuv;
+      rgb.resize(fr.getRGBSize());
+      yuv.resize(fr.getYUVSize());
+      memcpy(yuv.data(), i420, yuv.size());
+      const uint8_t *u = i420 + fr.width * fr.height;
+      const uint8_t *v = u + (fr.width / 2) * (fr.height / 2);
+      libyuv::I420ToRGB24(i420, fr.width, u, fr.width / 2, v, fr.width / 2, rgb.data(), fr.aligned_width * 3, fr.width, fr.height);
+      ++decoded;
+    });
+    const double ms = millis_since_boot() - start_ts;
+    printf("parallel: %zu/%zu frames in %.1f ms, %.1f frames/s, decode %.2f ms/frame (%zu decoders)\n", decoded.load(),
+           fr.getFrameCount(), ms, decoded * 1000.0 / ms, fr.cacheStats().avgDecodeMs(), fr.getDecoderCount());
+  }
+  return 0;
+}
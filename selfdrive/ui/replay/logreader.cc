@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include "selfdrive/common/timing.h"
 #include "selfdrive/ui/replay/util.h"
 
 Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(amsg), frame(frame) {
@@ -56,12 +57,15 @@ bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool loca
 }
 
 bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abort) {
+  double t = millis_since_boot();
   raw_ = decompressBZ2(data, size);
+  stats.decompress_ms = millis_since_boot() - t;
   if (raw_.empty()) {
     std::cout << "failed to decompress log" << std::endl;
     return false;
   }
 
+  t = millis_since_boot();
   try {
     kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw_.data(), raw_.size() / sizeof(capnp::word));
     while (words.size() > 0) {
@@ -96,6 +100,10 @@ bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abor
     std::cout << "read " << events.size() << " events from corrupt log" << std::endl;
   }
 
+  stats.parse_ms = millis_since_boot() - t;
+
+  t = millis_since_boot();
   std::sort(events.begin(), events.end(), Event::lessThan());
+  stats.sort_ms = millis_since_boot() - t;
   return true;
 }
@@ -46,6 +46,12 @@ public:
   bool frame;
 };
 
+struct LogReaderStats {
+  double decompress_ms = 0;
+  double parse_ms = 0;
+  double sort_ms = 0;
+};
+
 class LogReader {
 public:
   LogReader(size_t memory_pool_block_size = DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE);
@@ -54,6 +60,7 @@ public:
   bool load(const std::byte *data, size_t size, std::atomic<bool> *abort = nullptr);
 
   std::vector<Event*> events;
+  LogReaderStats stats;
 
 private:
   std::string raw_;
@@ -103,6 +103,7 @@ int main(int argc, char *argv[]) {
       {"qcam", REPLAY_FLAG_QCAMERA, "load qcamera"},
       {"yuv", REPLAY_FLAG_SEND_YUV, "send yuv frame"},
       {"no-cuda", REPLAY_FLAG_NO_CUDA, "disable CUDA"},
+      {"lockstep", REPLAY_FLAG_LOCKSTEP, "publish as fast as the subscribers keep up"},
   };
 
   QCommandLineParser parser;
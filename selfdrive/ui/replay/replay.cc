@@ -27,6 +27,10 @@ Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *s
   if (sm == nullptr) {
     pm = std::make_unique<PubMaster>(s);
   }
+  if ((flags_ & REPLAY_FLAG_LOCKSTEP) && messaging_use_zmq()) {
+    qWarning() << "lockstep mode requires msgq, publishing without backpressure";
+  }
+  lockstep_readers_.resize(sockets_.size(), READERS_UNKNOWN);
   route_ = std::make_unique<Route>(route, data_dir);
   events_ = std::make_unique<std::vector<Event *>>();
   new_events_ = std::make_unique<std::vector<Event *>>();
@@ -104,6 +108,8 @@ void Replay::doSeek(int seconds, bool relative) {
     }
 
     qInfo() << "seeking to" << seconds << "s, segment" << seg;
+    // give readers that timed out another chance
+    std::fill(lockstep_readers_.begin(), lockstep_readers_.end(), READERS_UNKNOWN);
     current_segment_ = seg;
     cur_mono_time_ = route_start_ts_ + seconds * 1e9;
     return isSegmentMerged(seg);
@@ -246,7 +252,35 @@ void Replay::publishMessage(const Event *e) {
       sockets_[e->which] = nullptr;
     }
   } else {
-    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], e->event}});
+    // lockstep mode runs on the virtual clock of the log
+    uint64_t mono_time = (flags_ & REPLAY_FLAG_LOCKSTEP) ? e->mono_time : nanos_since_boot();
+    sm->update_msgs(mono_time, {{sockets_[e->which], e->event}});
+  }
+}
+
+void Replay::waitForReaders(cereal::Event::Which which) {
+  // a socket is only waited on after its readers were seen keeping up with it,
+  // so services nobody subscribes to don't stall the stream.
+  const char *sock = sockets_[which];
+  if (lockstep_readers_[which] == READERS_TIMED_OUT) {
+    return;
+  } else if (lockstep_readers_[which] == READERS_UNKNOWN) {
+    if (pm->all_readers_updated(sock)) {
+      lockstep_readers_[which] = READERS_KEEPING_UP;
+    }
+    return;
+  }
+
+  const uint64_t start_ts = nanos_since_boot();
+  int sleep_us = 50;
+  while (!updating_events_ && !pm->all_readers_updated(sock)) {
+    if ((nanos_since_boot() - start_ts) > LOCKSTEP_READER_TIMEOUT_NS) {
+      qDebug() << "readers of" << sock << "didn't catch up, stop waiting for them until the next seek";
+      lockstep_readers_[which] = READERS_TIMED_OUT;
+      break;
+    }
+    usleep(sleep_us);
+    sleep_us = std::min(sleep_us * 2, LOCKSTEP_READER_MAX_SLEEP_US);
   }
 }
 
@@ -269,6 +303,10 @@ void Replay::publishFrame(const Event *e) {
 
 void Replay::stream() {
   float last_print = 0;
+  uint64_t last_print_ts = nanos_since_boot();
+  uint64_t published = 0;
+  const bool lockstep = (flags_ & REPLAY_FLAG_LOCKSTEP);
+  const bool backpressure = lockstep && pm && !messaging_use_zmq();
   cereal::Event::Which cur_which = cereal::Event::Which::INIT_DATA;
 
   std::unique_lock lk(stream_lock_);
@@ -294,8 +332,15 @@ void Replay::stream() {
       cur_mono_time_ = evt->mono_time;
       const int current_ts = currentSeconds();
       if (last_print > current_ts || (current_ts - last_print) > 5.0) {
+        const double elapsed = (nanos_since_boot() - last_print_ts) / 1e9;
+        if (lockstep && current_ts > last_print) {
+          qInfo() << "at " << current_ts << "s," << published / elapsed << "events/s," << (current_ts - last_print) / elapsed << "x realtime";
+        } else {
+          qInfo() << "at " << current_ts << "s";
+        }
         last_print = current_ts;
-        qInfo() << "at " << current_ts << "s";
+        last_print_ts = nanos_since_boot();
+        published = 0;
       }
       setCurrentSegment(current_ts / 60);
 
@@ -309,24 +354,36 @@ void Replay::stream() {
       }
 
       if (cur_which < sockets_.size() && sockets_[cur_which] != nullptr) {
-        // keep time
-        long etime = cur_mono_time_ - evt_start_ts;
-        long rtime = nanos_since_boot() - loop_start_ts;
-        long behind_ns = etime - rtime;
-        // if behind_ns is greater than 1 second, it means that an invalid segemnt is skipped by seeking/replaying
-        if (behind_ns >= 1 * 1e9) {
-          // reset start times
-          evt_start_ts = cur_mono_time_;
-          loop_start_ts = nanos_since_boot();
-        } else if (behind_ns > 0) {
-          precise_nano_sleep(behind_ns);
+        if (lockstep) {
+          // no wall clock pacing, wait for the subscribers to read the previous message instead
+          if (backpressure && !evt->frame) {
+            waitForReaders(cur_which);
+          }
+        } else {
+          // keep time
+          long etime = cur_mono_time_ - evt_start_ts;
+          long rtime = nanos_since_boot() - loop_start_ts;
+          long behind_ns = etime - rtime;
+          // if behind_ns is greater than 1 second, it means that an invalid segemnt is skipped by seeking/replaying
+          if (behind_ns >= 1 * 1e9) {
+            // reset start times
+            evt_start_ts = cur_mono_time_;
+            loop_start_ts = nanos_since_boot();
+          } else if (behind_ns > 0) {
+            precise_nano_sleep(behind_ns);
+          }
         }
 
         if (evt->frame) {
           publishFrame(evt);
+          if (lockstep) {
+            // keep frames in order with the messages
+            camera_server_->waitFinish();
+          }
         } else {
           publishMessage(evt);
         }
+        ++published;
       }
     }
     // wait for frame to be sent before unlock.(frameReader may be deleted after unlock)
@@ -7,6 +7,11 @@
 
 // one segment uses about 100M of memory
 constexpr int FORWARD_SEGS = 5;
+// in lockstep mode, stop waiting for the readers of a socket if they didn't catch up within this time,
+// until the next seek or restart
+constexpr uint64_t LOCKSTEP_READER_TIMEOUT_NS = 1 * 1e9;
+// while waiting, the readers are checked with a sleep doubling up to this
+constexpr int LOCKSTEP_READER_MAX_SLEEP_US = 1000;
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -17,6 +22,7 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_QCAMERA = 0x0040,
   REPLAY_FLAG_SEND_YUV = 0x0080,
   REPLAY_FLAG_NO_CUDA = 0x0100,
+  REPLAY_FLAG_LOCKSTEP = 0x0200,
 };
 
 class Replay : public QObject {
@@ -50,6 +56,7 @@ protected:
   void updateEvents(const std::function<bool()>& lambda);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
+  void waitForReaders(cereal::Event::Which which);
   inline int currentSeconds() const { return (cur_mono_time_ - route_start_ts_) / 1e9; }
   inline bool isSegmentMerged(int n) {
     return std::find(segments_merged_.begin(), segments_merged_.end(), n) != segments_merged_.end();
@@ -77,6 +84,8 @@ protected:
   SubMaster *sm = nullptr;
   std::unique_ptr<PubMaster> pm;
   std::vector<const char*> sockets_;
+  enum LockstepReaders : uint8_t { READERS_UNKNOWN, READERS_KEEPING_UP, READERS_TIMED_OUT };
+  std::vector<LockstepReaders> lockstep_readers_;
   std::unique_ptr<Route> route_;
   std::unique_ptr<CameraServer> camera_server_;
   uint32_t flags_ = REPLAY_FLAG_NONE;
@@ -0,0 +1,163 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "cereal/services.h"
+#include "selfdrive/common/benchmark.h"
+#include "selfdrive/ui/replay/camera.h"
+#include "selfdrive/ui/replay/route.h"
+
+// headless benchmark of the replay pipeline on a local route, independent of the UI.
+// reports time, throughput and heap allocations for each stage, and the peak RSS. decompress, parse and
+// sort are timed inside LogReader::load, their allocations are counted together in log load. the road
+// camera frames are sent through CameraServer as replay sends them.
+// usage: replay_benchmark <route> <data_dir> [segments]
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <route> <data_dir> [segments]\n", argv[0]);
+    return 1;
+  }
+  const int max_segments = argc > 3 ? atoi(argv[3]) : 3;
+
+  Route route(argv[1], argv[2]);
+  if (!route.load()) {
+    printf("failed to load route %s from %s\n", argv[1], argv[2]);
+    return 1;
+  }
+
+  using benchmark::measure;
+  benchmark::Stage read = {"read", "MB"}, load = {"log load", "events"}, decompress = {"decompress", "MB"},
+                   parse = {"parse", "events"}, sort = {"sort", "events"}, merge = {"merge", "events"},
+                   publish = {"publish", "events"}, frame_load = {"frame load", "frames"},
+                   decode = {"frame decode", "frames"}, vipc = {"vipc send", "frames"};
+
+  std::vector<std::unique_ptr<LogReader>> logs;
+  std::map<int, std::unique_ptr<FrameReader>> frames;  // of the road camera, by segment
+  for (const auto &[n, files] : route.segments()) {
+    if (logs.size() >= max_segments) break;
+
+    const std::string log_file = (files.rlog.isEmpty() ? files.qlog : files.rlog).toStdString();
+    if (log_file.empty()) continue;
+
+    std::string data;
+    measure(read, [&]() {
+      data = FileReader(true).read(log_file);
+      return data.size() / (1024 * 1024);
+    });
+    auto log = std::make_unique<LogReader>();
+    bool loaded = false;
+    measure(load, [&]() {
+      loaded = log->load((std::byte *)data.data(), data.size());
+      return log->events.size();
+    });
+    if (!loaded) {
+      printf("failed to load %s\n", log_file.c_str());
+      return 1;
+    }
+    decompress.ns.push_back(log->stats.decompress_ms * 1e6);
+    decompress.count += data.size() / (1024 * 1024);
+    parse.ns.push_back(log->stats.parse_ms * 1e6);
+    parse.count += log->events.size();
+    sort.ns.push_back(log->stats.sort_ms * 1e6);
+    sort.count += log->events.size();
+    logs.push_back(std::move(log));
+
+    if (!files.road_cam.isEmpty()) {
+      auto fr = std::make_unique<FrameReader>();
+      measure(frame_load, [&]() { return fr->load(files.road_cam.toStdString(), true) ? fr->getFrameCount() : 0; });
+      if (fr->valid()) {
+        auto rgb = std::make_unique<uint8_t[]>(fr->getRGBSize());
+        measure(decode, [&]() {
+          size_t decoded = 0;
+          for (int i = 0; i < fr->getFrameCount(); ++i) {
+            decoded += fr->get(i, rgb.get(), nullptr);
+          }
+          return decoded;
+        });
+        frames[n] = std::move(fr);
+      }
+    }
+  }
+
+  // merge segments the same way as Replay::mergeSegments
+  std::vector<Event *> events;
+  measure(merge, [&]() {
+    for (const auto &log : logs) {
+      auto middle = events.insert(events.end(), log->events.begin(), log->events.end());
+      std::inplace_merge(events.begin(), middle, events.end(), Event::lessThan());
+    }
+    return events.size();
+  });
+
+  std::vector<const char *> service_names;
+  std::map<cereal::Event::Which, const char *> sockets;
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  for (const auto &it : services) {
+    uint16_t which = event_struct.getFieldByName(it.name).getProto().getDiscriminantValue();
+    sockets[(cereal::Event::Which)which] = it.name;
+    service_names.push_back(it.name);
+  }
+  PubMaster pm(service_names);
+  measure(publish, [&]() {
+    size_t sent = 0;
+    for (const Event *e : events) {
+      auto it = sockets.find(e->which);
+      if (!e->frame && it != sockets.end()) {
+        auto bytes = e->bytes();
+        sent += pm.send(it->second, (capnp::byte *)bytes.begin(), bytes.size()) != -1;
+      }
+    }
+    return sent;
+  });
+
+  if (!frames.empty()) {
+    std::pair<int, int> camera_size[MAX_CAMERAS] = {};
+    camera_size[RoadCam] = {frames.begin()->second->width, frames.begin()->second->height};
+    CameraServer camera_server(camera_size);
+    measure(vipc, [&]() {
+      size_t sent = 0;
+      for (const Event *e : events) {
+        if (e->frame && e->which == cereal::Event::ROAD_ENCODE_IDX) {
+          auto eidx = e->event.getRoadEncodeIdx();
+          auto fr = frames.find(eidx.getSegmentNum());
+          if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && fr != frames.end()) {
+            camera_server.pushFrame(RoadCam, fr->second.get(), eidx);
+            ++sent;
+          }
+        }
+      }
+      camera_server.waitFinish();
+      return sent;
+    });
+  }
+
+  printf("%d segments of %s\n", (int)logs.size(), argv[1]);
+  printf("%-14s %12s %14s %18s %14s\n", "stage", "time (ms)", "count", "rate (/s)", "allocations");
+  for (const benchmark::Stage *s : {&read, &load, &decompress, &parse, &sort, &merge, &publish, &frame_load, &decode, &vipc}) {
+    const double ms = s->total_ns() / 1e6;
+    const bool in_load = s == &decompress || s == &parse || s == &sort;
+    printf("%-14s %12.1f %8lu %-6s %18.1f %14s\n", s->name, ms, s->count, s->unit, ms > 0 ? s->count * 1000.0 / ms : 0,
+           in_load ? "-" : std::to_string(s->allocs).c_str());
+  }
+
+  // frame cache of the road camera over the decode and vipc send stages
+  FrameCacheStats cache_stats;
+  for (const auto &[n, fr] : frames) {
+    const FrameCacheStats stats = fr->cacheStats();
+    cache_stats.hits += stats.hits;
+    cache_stats.misses += stats.misses;
+    cache_stats.decoded_frames += stats.decoded_frames;
+    cache_stats.decode_ms += stats.decode_ms;
+  }
+  printf("frame cache hit rate: %.1f%%, decode %.2f ms/frame\n", cache_stats.hitRate() * 100, cache_stats.avgDecodeMs());
+
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  printf("peak RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);
+  return 0;
+}
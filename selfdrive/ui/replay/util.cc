@@ -96,8 +96,9 @@ void enableHttpLogging(bool enable) {
   enable_http_logging = enable;
 }
 
+// download [offset, offset + content_length) of url into buf
 template <class T>
-bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t content_length, std::atomic<bool> *abort) {
+bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t offset, size_t content_length, std::atomic<bool> *abort) {
   static CURLGlobalInitializer curl_initializer;
 
   int parts = 1;
@@ -121,7 +122,7 @@ bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t cont
     curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb<T>);
     curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void *)(&writers[eh]));
     curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%d-%d", writers[eh].offset, writers[eh].end - 1).c_str());
+    curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%zu-%zu", offset + writers[eh].offset, offset + writers[eh].end - 1).c_str());
     curl_easy_setopt(eh, CURLOPT_HTTPGET, 1);
     curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt(eh, CURLOPT_FOLLOWLOCATION, 1);
@@ -181,7 +182,14 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   if (size == 0) return {};
 
   std::string result(size, '\0');
-  return httpDownload(url, result, chunk_size, size, abort) ? result : "";
+  return httpDownload(url, result, chunk_size, 0, size, abort) ? result : "";
+}
+
+std::string httpGetRange(const std::string &url, size_t offset, size_t size, std::atomic<bool> *abort) {
+  if (size == 0) return {};
+
+  std::string result(size, '\0');
+  return httpDownload(url, result, 0, offset, size, abort) ? result : "";
 }
 
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
@@ -190,7 +198,7 @@ bool httpDownload(const std::string &url, const std::string &file, size_t chunk_
 
   std::ofstream of(file, std::ios::binary | std::ios::out);
   of.seekp(size - 1).write("\0", 1);
-  return httpDownload(url, of, chunk_size, size, abort);
+  return httpDownload(url, of, chunk_size, 0, size, abort);
 }
 
 std::string decompressBZ2(const std::string &in) {